@@ -0,0 +1,458 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+// Ping-pong loopback contre un serveur echo à une boucle d'E/S : un client bloquant envoie un message, attend l'echo
+// complet, recommence. Affiche le débit, les percentiles du temps aller-retour, et par message les itérations des
+// boucles du serveur (EventLoop::heartbeat), les EPOLLIN traités (EventLoop::read_wakeups), les SO_RCVLOWAT posés
+// et les appels à epoll_ctl (EventLoop::epoll_ctl_calls).
+//
+//   loopback_bench [--uds] [--connect] [--profile=default|request_response] [--sticky] [--frames] [--rcvlowat]
+//                  [--segments=N] [--gap-us=US] [--messages=N] [--payload=OCTETS] [--port=PORT]
+//
+//   --uds : socket Unix (espace de noms abstrait) au lieu de TCP sur 127.0.0.1, pour comparer les deux transports
+//   --connect : une connexion par message (connect, requête, réponse, RST), le temps mesuré inclut l'établissement
+//   --profile : ListenerProfile du listener TCP ; avec request_response et --connect, la requête part dans le SYN
+//               (MSG_FASTOPEN) si net.ipv4.tcp_fastopen le permet
+//   --sticky : EPOLLOUT permanent (TcpServer::set_sticky_write_interest)
+//   --frames : messages préfixés par leur longueur (4 octets), le serveur ne renvoie que des trames complètes
+//   --rcvlowat : avec --frames, le serveur attend la fin d'une trame incomplète par TcpConnection::await_frame_bytes
+//   --segments, --gap-us : chaque message part en N morceaux espacés de US microsecondes (50 par défaut), pour qu'une
+//                          trame arrive en plusieurs fois ; sans effet avec --connect
+
+#include "tcpserver/TcpServer.hpp"
+#include "tcpserver/TcpConnection.hpp"
+#include "tcpserver/EventLoop.hpp"
+#include "buffer/ProtoBuffer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unordered_map>
+#include <unistd.h>
+#include <vector>
+
+#define WARMUP_MESSAGES 1000
+// en mode --connect : de quoi obtenir le cookie TFO
+#define WARMUP_CONNECTIONS 100
+// les acceptors écoutent depuis leur boucle, peu après start()
+#define CONNECT_ATTEMPTS 200
+// SO_SNDBUF/SO_RCVBUF du listener TCP : 0 donnerait le minimum du noyau et fausserait les gros payloads
+#define SOCKET_BUFFER_BYTES (1 << 20)
+
+struct BenchOptions
+{
+    bool uds{false};
+    bool connect_per_message{false};
+    bool request_response{false};
+    bool sticky{false};
+    bool frames{false};
+    bool rcvlowat{false};
+    size_t segments{1};
+    size_t gap_us{50};
+    size_t messages{100000};
+    size_t payload{64};
+    uint16_t port{19320};
+};
+
+static bool parse_options(int argc, char **argv, BenchOptions &opts)
+{
+    static const option long_options[] = {
+            {"uds",      no_argument,       nullptr, 'u'},
+            {"connect",  no_argument,       nullptr, 'c'},
+            {"profile",  required_argument, nullptr, 'P'},
+            {"sticky",   no_argument,       nullptr, 's'},
+            {"frames",   no_argument,       nullptr, 'f'},
+            {"rcvlowat", no_argument,       nullptr, 'r'},
+            {"segments", required_argument, nullptr, 'S'},
+            {"gap-us",   required_argument, nullptr, 'g'},
+            {"messages", required_argument, nullptr, 'm'},
+            {"payload",  required_argument, nullptr, 'l'},
+            {"port",     required_argument, nullptr, 'p'},
+            {nullptr, 0,                    nullptr, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 'u':
+                opts.uds = true;
+                break;
+            case 'c':
+                opts.connect_per_message = true;
+                break;
+            case 'P':
+                if (strcmp(optarg, "default") != 0 && strcmp(optarg, "request_response") != 0)
+                {
+                    return false;
+                }
+                opts.request_response = strcmp(optarg, "request_response") == 0;
+                break;
+            case 's':
+                opts.sticky = true;
+                break;
+            case 'f':
+                opts.frames = true;
+                break;
+            case 'r':
+                opts.rcvlowat = true;
+                break;
+            case 'S':
+                opts.segments = std::max<size_t>(strtoul(optarg, nullptr, 10), 1);
+                break;
+            case 'g':
+                opts.gap_us = strtoul(optarg, nullptr, 10);
+                break;
+            case 'm':
+                opts.messages = strtoul(optarg, nullptr, 10);
+                break;
+            case 'l':
+                opts.payload = std::max<size_t>(strtoul(optarg, nullptr, 10), 1);
+                break;
+            case 'p':
+                opts.port = (uint16_t) strtoul(optarg, nullptr, 10);
+                break;
+            default:
+                return false;
+        }
+    }
+    return optind == argc && opts.messages > 0 && (opts.frames || !opts.rcvlowat);
+}
+
+static std::string unix_name()
+{
+    return "tks-bench-" + std::to_string(getpid());
+}
+
+static bool send_all(int fd, const uint8_t *data, size_t len)
+{
+    while (len > 0)
+    {
+        const ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, uint8_t *data, size_t len)
+{
+    while (len > 0)
+    {
+        const ssize_t n = ::recv(fd, data, len, 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+// first_message non nul : envoyé avec la connexion, dans le SYN en TCP si le profil active TFO
+static int connect_once(BenchOptions const &opts, std::vector<uint8_t> const *first_message)
+{
+    int fd;
+    if (opts.uds)
+    {
+        const std::string name = unix_name();
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path + 1, name.data(), name.size());
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && ::connect(fd, (sockaddr *) &addr, (socklen_t) (offsetof(sockaddr_un, sun_path) + 1 + name.size())) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(opts.port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const int yes = 1;
+        if (fd < 0 || ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)) != 0)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            return -1;
+        }
+        if (first_message != nullptr && opts.request_response)
+        {
+            // sans cookie ou sans net.ipv4.tcp_fastopen & 1, le noyau fait un connect classique puis envoie
+            const ssize_t n = ::sendto(fd, first_message->data(), first_message->size(), MSG_FASTOPEN | MSG_NOSIGNAL,
+                                       (sockaddr *) &addr, sizeof(addr));
+            if (n != (ssize_t) first_message->size())
+            {
+                ::close(fd);
+                return -1;
+            }
+            return fd;
+        }
+        if (::connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+    }
+    if (first_message != nullptr && !send_all(fd, first_message->data(), first_message->size()))
+    {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int dial(BenchOptions const &opts, std::vector<uint8_t> const *first_message)
+{
+    for (int attempt = 0; attempt < CONNECT_ATTEMPTS; ++attempt)
+    {
+        const int fd = connect_once(opts, first_message);
+        if (fd >= 0 || (errno != ECONNREFUSED && errno != ENOENT))
+        {
+            return fd;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return -1;
+}
+
+// un échange complet ; false si le serveur a fermé
+static bool round_trip(BenchOptions const &opts, int fd, std::vector<uint8_t> &message, std::vector<uint8_t> &echo)
+{
+    const size_t segment = (message.size() + opts.segments - 1) / opts.segments;
+    for (size_t offset = 0; offset < message.size(); offset += segment)
+    {
+        if (offset > 0 && opts.gap_us > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(opts.gap_us));
+        }
+        if (!send_all(fd, message.data() + offset, std::min(segment, message.size() - offset)))
+        {
+            return false;
+        }
+    }
+    return recv_all(fd, echo.data(), echo.size());
+}
+
+// connexion, requête, réponse ; fermée par un RST pour ne pas épuiser les ports éphémères en TIME_WAIT
+static bool connect_round_trip(BenchOptions const &opts, std::vector<uint8_t> &message, std::vector<uint8_t> &echo)
+{
+    const int fd = dial(opts, &message);
+    if (fd < 0)
+    {
+        return false;
+    }
+    const bool ok = recv_all(fd, echo.data(), echo.size());
+    const linger reset{1, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    ::close(fd);
+    return ok;
+}
+
+struct LoopCounters
+{
+    uint64_t iterations{0};
+    uint64_t epoll_ctl_calls{0};
+    uint64_t read_wakeups{0};
+    uint64_t rcvlowat_arms{0};
+};
+
+static LoopCounters server_counters(TcpServer const &server)
+{
+    LoopCounters total;
+    for (EventLoop *loop: server.loops())
+    {
+        total.iterations += loop->heartbeat();
+        total.epoll_ctl_calls += loop->epoll_ctl_calls();
+        total.read_wakeups += loop->read_wakeups();
+        total.rcvlowat_arms += loop->rcvlowat_arms();
+    }
+    return total;
+}
+
+// --frames : renvoie les trames complètes de input et retire ce qui a été renvoyé
+static void echo_frames(BenchOptions const &opts, std::shared_ptr<TcpConnection> const &conn, std::string &input)
+{
+    size_t offset = 0;
+    uint32_t length = 0;
+    while (input.size() - offset >= sizeof(length))
+    {
+        memcpy(&length, input.data() + offset, sizeof(length));
+        const size_t frame = sizeof(length) + length;
+        if (input.size() - offset < frame)
+        {
+            break;
+        }
+        auto *out = new ProtoBuffer((uint32_t) frame);
+        out->writeBytes((const uint8_t *) input.data() + offset, (uint32_t) frame);
+        out->flip();
+        conn->write_buffer(out);
+        offset += frame;
+    }
+    input.erase(0, offset);
+    if (opts.rcvlowat && !input.empty())
+    {
+        // sans en-tête complet, on attend au moins l'en-tête
+        const size_t frame = input.size() >= sizeof(length) ? sizeof(length) + length : sizeof(length);
+        conn->await_frame_bytes((uint32_t) (frame - input.size()));
+    }
+}
+
+static double percentile_us(std::vector<int64_t> const &sorted_ns, double p)
+{
+    const auto rank = (size_t) (p * (double) (sorted_ns.size() - 1));
+    return (double) sorted_ns[rank] / 1000.0;
+}
+
+[[noreturn]] static void fail(const char *what)
+{
+    printf("FAIL: %s\n", what);
+    fflush(stdout);
+    _exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions opts;
+    if (!parse_options(argc, argv, opts))
+    {
+        fprintf(stderr, "usage: %s [--uds] [--connect] [--profile=default|request_response] [--messages=N] "
+                        "[--sticky] [--frames] [--rcvlowat] [--segments=N] [--gap-us=US] [--payload=BYTES] [--port=PORT]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    EventLoop loop;
+    std::unique_ptr<TcpServer> server;
+    if (opts.uds)
+    {
+        server = std::make_unique<TcpServer>(&loop, "@" + unix_name(), "bench", 1, 1);
+    }
+    else
+    {
+        server = std::make_unique<TcpServer>(&loop, opts.port, "bench", 1, SOCKET_BUFFER_BYTES, SOCKET_BUFFER_BYTES, 1);
+        if (opts.request_response)
+        {
+            server->set_listener_profile(ListenerProfile::request_response());
+        }
+    }
+    server->set_sticky_write_interest(opts.sticky);
+    // --frames : octets reçus d'une trame pas encore complète, par connexion (une seule boucle d'E/S)
+    std::unordered_map<TcpConnection *, std::string> pending;
+    server->set_on_connection_state_change([&pending](std::shared_ptr<TcpConnection> const &conn) {
+        if (!conn->is_connected())
+        {
+            pending.erase(conn.get());
+        }
+    });
+    server->set_on_write_complete([](std::shared_ptr<TcpConnection> const &) {});
+    server->set_on_data_received([&opts, &pending](std::shared_ptr<TcpConnection> const &conn, ProtoBuffer *buf, int64_t) {
+        if (opts.frames)
+        {
+            std::string &input = pending[conn.get()];
+            input.append((const char *) buf->bytes(), buf->limit());
+            echo_frames(opts, conn, input);
+            return;
+        }
+        auto *out = new ProtoBuffer(buf->limit());
+        out->writeBytes(buf->bytes(), buf->limit());
+        out->flip();
+        conn->write_buffer(out);
+    });
+    server->start();
+
+    std::thread client([&] {
+        std::vector<uint8_t> message(opts.payload, 0x5a);
+        if (opts.frames)
+        {
+            const auto length = (uint32_t) opts.payload;
+            message.insert(message.begin(), (const uint8_t *) &length, (const uint8_t *) &length + sizeof(length));
+        }
+        std::vector<uint8_t> echo(message.size());
+        int fd = -1;
+        if (!opts.connect_per_message)
+        {
+            fd = dial(opts, nullptr);
+            if (fd < 0)
+            {
+                fail(strerror(errno));
+            }
+        }
+        auto exchange = [&] {
+            return opts.connect_per_message ? connect_round_trip(opts, message, echo) : round_trip(opts, fd, message, echo);
+        };
+        const size_t warmup = opts.connect_per_message ? WARMUP_CONNECTIONS : WARMUP_MESSAGES;
+        for (size_t i = 0; i < warmup; ++i)
+        {
+            if (!exchange())
+            {
+                fail("connection closed during warm-up");
+            }
+        }
+
+        std::vector<int64_t> rtt_ns(opts.messages);
+        const LoopCounters before = server_counters(*server);
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < opts.messages; ++i)
+        {
+            const auto sent = std::chrono::steady_clock::now();
+            if (!exchange())
+            {
+                fail("connection closed during the measured run");
+            }
+            rtt_ns[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sent).count();
+        }
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const auto messages = (double) opts.messages;
+        const LoopCounters after = server_counters(*server);
+        const double iterations = (double) (after.iterations - before.iterations) / messages;
+        const double epoll_ctl_calls = (double) (after.epoll_ctl_calls - before.epoll_ctl_calls) / messages;
+        const double read_wakeups = (double) (after.read_wakeups - before.read_wakeups) / messages;
+        const double rcvlowat_arms = (double) (after.rcvlowat_arms - before.rcvlowat_arms) / messages;
+
+        std::sort(rtt_ns.begin(), rtt_ns.end());
+        printf("%s%s%s%s%s%s payload %zu, %zu sends/msg: %zu msgs, %.0f msgs/s, "
+               "rtt p50 %.1f us p99 %.1f us p99.9 %.1f us, per msg: loop wakeups %.2f, read wakeups %.2f, "
+               "rcvlowat arms %.2f, epoll_ctl %.2f\n",
+               opts.uds ? "uds" : "tcp", opts.connect_per_message ? " connect" : "",
+               opts.request_response ? " request_response" : "", opts.sticky ? " sticky" : "",
+               opts.frames ? " frames" : "", opts.rcvlowat ? " rcvlowat" : "", opts.payload,
+               opts.connect_per_message ? 1 : opts.segments, opts.messages, messages / elapsed,
+               percentile_us(rtt_ns, 0.50), percentile_us(rtt_ns, 0.99), percentile_us(rtt_ns, 0.999), iterations,
+               read_wakeups, rcvlowat_arms, epoll_ctl_calls);
+        fflush(stdout);
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        _exit(EXIT_SUCCESS);
+    });
+    loop.loop();
+    client.join();
+    return EXIT_SUCCESS;
+}
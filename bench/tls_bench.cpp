@@ -0,0 +1,315 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+// TLS en loopback contre un serveur echo (TcpServer::set_tls) : débit de handshakes complets, puis débit d'un echo
+// en masse sur plusieurs connexions. Affiche aussi les connexions passées en kTLS (TlsContext::stats).
+//
+//   tls_bench --cert=PEM --key=PEM [--handshakes=N] [--clients=N] [--bulk-mib=N] [--no-ktls] [--threads=N]
+//             [--port=PORT]
+//
+// Un certificat de test :
+//   openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes -days 30 -subj /CN=localhost
+//           -keyout key.pem -out cert.pem
+//
+// Les handshakes sont complets (pas de reprise de session) ; chaque client en enchaîne handshakes / clients.
+// La phase echo ouvre clients connexions qui envoient et relisent chacune bulk-mib Mio en parallèle.
+
+#include "tcpserver/TcpServer.hpp"
+#include "tcpserver/TcpConnection.hpp"
+#include "tcpserver/TlsContext.hpp"
+#include "tcpserver/EventLoop.hpp"
+#include "buffer/ProtoBuffer.h"
+
+#include <openssl/ssl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// les acceptors écoutent depuis leur boucle, peu après start()
+#define CONNECT_ATTEMPTS 200
+#define SOCKET_BUFFER_BYTES (1 << 20)
+#define BULK_CHUNK_BYTES (256 * 1024)
+
+struct TlsBenchOptions
+{
+    std::string cert;
+    std::string key;
+    size_t handshakes{2000};
+    size_t clients{4};
+    size_t bulk_mib{64};
+    size_t threads{2};
+    bool ktls{true};
+    uint16_t port{19330};
+};
+
+static bool parse_options(int argc, char **argv, TlsBenchOptions &opts)
+{
+    static const option long_options[] = {
+            {"cert",       required_argument, nullptr, 'c'},
+            {"key",        required_argument, nullptr, 'k'},
+            {"handshakes", required_argument, nullptr, 'h'},
+            {"clients",    required_argument, nullptr, 'n'},
+            {"bulk-mib",   required_argument, nullptr, 'b'},
+            {"no-ktls",    no_argument,       nullptr, 'K'},
+            {"threads",    required_argument, nullptr, 't'},
+            {"port",       required_argument, nullptr, 'p'},
+            {nullptr, 0,                      nullptr, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                opts.cert = optarg;
+                break;
+            case 'k':
+                opts.key = optarg;
+                break;
+            case 'h':
+                opts.handshakes = strtoul(optarg, nullptr, 10);
+                break;
+            case 'n':
+                opts.clients = std::max<size_t>(strtoul(optarg, nullptr, 10), 1);
+                break;
+            case 'b':
+                opts.bulk_mib = strtoul(optarg, nullptr, 10);
+                break;
+            case 'K':
+                opts.ktls = false;
+                break;
+            case 't':
+                opts.threads = std::max<size_t>(strtoul(optarg, nullptr, 10), 1);
+                break;
+            case 'p':
+                opts.port = (uint16_t) strtoul(optarg, nullptr, 10);
+                break;
+            default:
+                return false;
+        }
+    }
+    return optind == argc && !opts.cert.empty() && !opts.key.empty();
+}
+
+static int dial(uint16_t port)
+{
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int attempt = 0; attempt < CONNECT_ATTEMPTS; ++attempt)
+    {
+        const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        if (::connect(fd, (sockaddr *) &addr, sizeof(addr)) == 0)
+        {
+            const int yes = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            return fd;
+        }
+        const int error = errno;
+        ::close(fd);
+        if (error != ECONNREFUSED)
+        {
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return -1;
+}
+
+// connexion TLS établie, nullptr en cas d'échec ; *fd reçoit le socket
+static SSL *tls_dial(SSL_CTX *ctx, uint16_t port, int *fd)
+{
+    *fd = dial(port);
+    if (*fd < 0)
+    {
+        return nullptr;
+    }
+    SSL *ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, *fd);
+    if (SSL_connect(ssl) != 1)
+    {
+        SSL_free(ssl);
+        ::close(*fd);
+        return nullptr;
+    }
+    return ssl;
+}
+
+static void tls_close(SSL *ssl, int fd)
+{
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    ::close(fd);
+}
+
+[[noreturn]] static void fail(const char *what)
+{
+    printf("FAIL: %s\n", what);
+    fflush(stdout);
+    _exit(EXIT_FAILURE);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// handshakes complets en parallèle sur opts.clients threads ; attend que le serveur les ait tous comptés
+static void run_handshakes(TlsBenchOptions const &opts, SSL_CTX *ctx, TlsContext const &tls)
+{
+    const uint64_t before = tls.stats().handshakes;
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (size_t c = 0; c < opts.clients; ++c)
+    {
+        const size_t count = opts.handshakes / opts.clients + (c < opts.handshakes % opts.clients ? 1 : 0);
+        clients.emplace_back([&opts, ctx, count] {
+            for (size_t i = 0; i < count; ++i)
+            {
+                int fd;
+                SSL *ssl = tls_dial(ctx, opts.port, &fd);
+                if (ssl == nullptr)
+                {
+                    fail("client handshake");
+                }
+                tls_close(ssl, fd);
+            }
+        });
+    }
+    for (auto &client: clients)
+    {
+        client.join();
+    }
+    // en TLS 1.3 le client termine avant que le serveur ait lu son Finished
+    while (tls.stats().handshakes - before < opts.handshakes)
+    {
+        if (seconds_since(start) > 60)
+        {
+            fail("server did not complete every handshake");
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    const double elapsed = seconds_since(start);
+    printf("handshakes: %zu in %.3f s with %zu clients, %.0f handshakes/s\n", opts.handshakes, elapsed, opts.clients,
+           (double) opts.handshakes / elapsed);
+}
+
+// chaque connexion envoie bulk_mib Mio par blocs de BULK_CHUNK_BYTES et relit l'echo de chaque bloc avant le suivant
+// (un SSL ne se partage pas entre deux threads) ; les connexions tournent en parallèle
+static void run_bulk(TlsBenchOptions const &opts, SSL_CTX *ctx)
+{
+    const size_t bytes = opts.bulk_mib << 20;
+    std::atomic<size_t> echoed{0};
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (size_t c = 0; c < opts.clients; ++c)
+    {
+        clients.emplace_back([&opts, ctx, bytes, &echoed] {
+            int fd;
+            SSL *ssl = tls_dial(ctx, opts.port, &fd);
+            if (ssl == nullptr)
+            {
+                fail("client handshake");
+            }
+            std::vector<char> chunk(BULK_CHUNK_BYTES, 'x');
+            std::vector<char> buffer(BULK_CHUNK_BYTES);
+            size_t received = 0;
+            while (received < bytes)
+            {
+                const size_t length = std::min(chunk.size(), bytes - received);
+                if (SSL_write(ssl, chunk.data(), (int) length) != (int) length)
+                {
+                    fail("bulk write");
+                }
+                for (size_t got = 0; got < length;)
+                {
+                    const int n = SSL_read(ssl, buffer.data(), (int) (length - got));
+                    if (n <= 0)
+                    {
+                        fail("bulk read");
+                    }
+                    got += (size_t) n;
+                }
+                received += length;
+            }
+            echoed.fetch_add(received, std::memory_order_relaxed);
+            tls_close(ssl, fd);
+        });
+    }
+    for (auto &client: clients)
+    {
+        client.join();
+    }
+    const double elapsed = seconds_since(start);
+    printf("bulk echo: %zu MiB on %zu connections in %.3f s, %.0f MiB/s each way\n", echoed.load() >> 20,
+           opts.clients, elapsed, (double) (echoed.load() >> 20) / elapsed);
+}
+
+int main(int argc, char **argv)
+{
+    TlsBenchOptions opts;
+    if (!parse_options(argc, argv, opts))
+    {
+        fprintf(stderr, "usage: %s --cert=PEM --key=PEM [--handshakes=N] [--clients=N] [--bulk-mib=N] [--no-ktls] "
+                        "[--threads=N] [--port=PORT]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    EventLoop loop;
+    auto tls = std::make_shared<TlsContext>(opts.cert, opts.key, opts.ktls);
+    TcpServer server(&loop, opts.port, "tls-bench", 1, SOCKET_BUFFER_BYTES, SOCKET_BUFFER_BYTES, (uint32_t) opts.threads);
+    server.set_tls(tls);
+    server.set_on_connection_state_change([](std::shared_ptr<TcpConnection> const &) {});
+    server.set_on_write_complete([](std::shared_ptr<TcpConnection> const &) {});
+    server.set_on_data_received([](std::shared_ptr<TcpConnection> const &conn, ProtoBuffer *buf, int64_t) {
+        auto *out = new ProtoBuffer(buf->limit());
+        out->writeBytes(buf->bytes(), buf->limit());
+        out->flip();
+        conn->write_buffer(out);
+    });
+    server.start();
+
+    std::thread client([&] {
+        SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+        if (opts.handshakes > 0)
+        {
+            run_handshakes(opts, ctx, *tls);
+        }
+        const TlsStats before = tls->stats();
+        if (opts.bulk_mib > 0)
+        {
+            run_bulk(opts, ctx);
+        }
+        const TlsStats after = tls->stats();
+        printf("kernel offload %s: %lu/%zu bulk connections with kTLS tx, %lu with kTLS rx, %lu handshake failures\n",
+               opts.ktls ? "requested" : "off", after.ktls_tx - before.ktls_tx, opts.bulk_mib > 0 ? opts.clients : 0,
+               after.ktls_rx - before.ktls_rx, after.handshake_failures);
+        fflush(stdout);
+        SSL_CTX_free(ctx);
+        _exit(EXIT_SUCCESS);
+    });
+    loop.loop();
+    client.join();
+    return EXIT_SUCCESS;
+}
@@ -9,48 +9,138 @@
 #include <string>
 #include <memory>
 #include <functional>
+#include <atomic>
 
 #include "EventLoop.hpp"
+#include "ListenerProfile.hpp"
 #include "fastlog/not_copyable.hpp"
 
 class EventLoop;
 class Channel;
 class TcpConnection;
+struct ConnectionCallbacks;
+class AdmissionControl;
+class PeerAddress;
+class TlsContext;
+class Timer;
 
 class Acceptor : notcopyable
 {
 private:
     EventLoop *m_loop;
     int m_listening_port;
+    int m_family;
     std::unique_ptr<Channel> m_channel;
     bool m_listening{false};
     std::unordered_map<long, std::shared_ptr<TcpConnection>> m_connections;
+    std::atomic<size_t> m_connection_count{0}; // lisible depuis n'importe quel thread
+
+    // équité face à une rafale de connexions
+    uint32_t m_accept_budget{64};     // accept4 max par réveil, le reste est repris à l'itération suivante
+    size_t m_max_connections{0};      // limite de cette boucle, 0 : illimité
+    AdmissionControl *m_admission{nullptr};
+    int m_spare_fd{-1};               // fd de réserve libéré sur EMFILE pour accepter puis fermer la connexion
+    bool m_paused{false};             // listener retiré d'epoll faute de place
+    bool m_resume_scheduled{false};
+    std::unique_ptr<Timer> m_no_fd_timer; // reprise d'un listener mis en pause sur EMFILE sans fd de réserve
+    // expire avec l'Acceptor : les tâches postées dans la boucle le testent avant de toucher à this
+    std::shared_ptr<bool> m_alive{std::make_shared<bool>(true)};
+
+    ListenerProfile m_profile;
+    std::shared_ptr<TlsContext> m_tls; // nullptr : connexions en clair
     std::function<void(const std::shared_ptr<TcpConnection> &, ProtoBuffer *buf, int64_t time)> m_data_received_cb;
     std::function<void(std::shared_ptr<TcpConnection> const &)> m_write_complete_cb;
     std::function<void(const std::shared_ptr<TcpConnection> &)> m_connection_state_change_cb;
+    // table partagée par toutes les connexions de cet Acceptor, reconstruite si un callback change
+    std::shared_ptr<const ConnectionCallbacks> m_conn_callbacks;
 
     void handleRead(int64_t);
 
-    void on_new_connection(int sock_fd, const std::string &ip, uint16_t port, int family);
+    void on_new_connection(int sock_fd, PeerAddress const &peer);
 
     void remove_connection_internal(std::shared_ptr<TcpConnection> const &conn);
 
+    [[nodiscard]] bool has_room() const;
+
+    void pause();
+
+    // false si aucun fd de réserve n'a permis de retirer la connexion de la file
+    bool reject_no_fd();
+
+    void pause_no_fd();
+
+    void apply_listener_profile();
+
+    void apply_connection_profile(int sock_fd) const;
+
 public:
     Acceptor(EventLoop *loop, int listen_port, int32_t snd_buff, int32_t rcv_buff);
 
+    // Adopte un socket déjà créé et lié (AF_INET, AF_INET6 ou AF_UNIX). L'Acceptor devient propriétaire du fd.
+    Acceptor(EventLoop *loop, int listen_fd);
+
     ~Acceptor();
 
-    void set_on_data_received(std::function<void(const std::shared_ptr<TcpConnection> &, ProtoBuffer *buf, int64_t time)> const &cb) { m_data_received_cb = cb; }
+    void set_on_data_received(std::function<void(const std::shared_ptr<TcpConnection> &, ProtoBuffer *buf, int64_t time)> const &cb) { m_data_received_cb = cb; m_conn_callbacks = nullptr; }
+
+    void set_on_write_complete(std::function<void(std::shared_ptr<TcpConnection> const &)> const &cb) { m_write_complete_cb = cb; m_conn_callbacks = nullptr; }
+
+    void set_on_connection_state_change(std::function<void(std::shared_ptr<TcpConnection> const &)> const &cb) { m_connection_state_change_cb = cb; m_conn_callbacks = nullptr; }
 
-    void set_on_write_complete(std::function<void(std::shared_ptr<TcpConnection> const &)> const &cb) { m_write_complete_cb = cb; }
+    // Avant listen() : options TCP du socket d'écoute et des connexions acceptées
+    void set_profile(ListenerProfile const &profile) { m_profile = profile; }
 
-    void set_on_connection_state_change(std::function<void(std::shared_ptr<TcpConnection> const &)> const &cb) { m_connection_state_change_cb = cb; }
+    // Avant listen() : les connexions acceptées sont servies en TLS, voir TcpConnection::start_tls()
+    void set_tls(std::shared_ptr<TlsContext> tls) { m_tls = std::move(tls); }
+
+    // Avant listen() : le socket d'écoute est partagé avec les Acceptors d'autres boucles (AF_UNIX, sans
+    // SO_REUSEPORT), une connexion entrante ne réveille qu'une boucle
+    void set_exclusive_wakeup();
 
     void listen();
 
     [[nodiscard]] bool listening() const { return m_listening; }
 
+    // Nombre maximal de accept4 par notification d'epoll (défaut 64, 0 : pas de limite). Évite qu'une rafale de SYN
+    // n'affame les connexions établies de la boucle.
+    void set_accept_budget(uint32_t budget) { m_accept_budget = budget; }
+
+    // Au-delà de max connexions sur cette boucle, le listener est mis en pause jusqu'à la fermeture d'une connexion
+    void set_max_connections(size_t max) { m_max_connections = max; }
+
+    // Limite globale partagée entre plusieurs Acceptors. L'objet doit survivre à l'Acceptor.
+    void set_admission_control(AdmissionControl *admission) { m_admission = admission; }
+
+    // À appeler dans le thread de la boucle : réarme le listener mis en pause s'il y a de nouveau de la place
+    void resume();
+
+    // Depuis n'importe quel thread : resume() dans la boucle, à l'itération courante ou suivante, sans effet si
+    // l'Acceptor est détruit d'ici là
+    void post_resume();
+
+    [[nodiscard]] bool paused() const { return m_paused; }
+
+    // À appeler dans le thread de la boucle : retire le socket d'écoute d'epoll et ferme notre fd.
+    // Les connexions établies ne sont pas touchées.
+    void stop_listening();
+
+    // À appeler dans le thread de la boucle : fermeture gracieuse de toutes les connexions
+    void drain();
+
+    // fd du socket d'écoute, -1 après stop_listening()
+    [[nodiscard]] int listen_fd() const;
+
+    [[nodiscard]] size_t connection_count() const { return m_connection_count.load(std::memory_order_relaxed); }
+
     [[nodiscard]] int listen_port() const { return m_listening_port; }
+
+    [[nodiscard]] int family() const { return m_family; }
+
+    [[nodiscard]] EventLoop *owner_loop() const { return m_loop; }
+
+    // Crée un socket AF_UNIX SOCK_STREAM non bloquant lié à path.
+    // Un path commençant par '@' désigne l'espace de noms abstrait (pas de fichier créé).
+    static int create_unix_socket(const std::string &path);
 };
 
 #endif // TKS_ACCEPTOR
@@ -0,0 +1,83 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_ADMISSION_CONTROL)
+#define TKS_ADMISSION_CONTROL
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include "fastlog/not_copyable.hpp"
+
+class Acceptor;
+
+struct AdmissionStats
+{
+    uint64_t accepted;          // connexions acceptées
+    uint64_t rejected_no_fd;    // acceptées puis fermées aussitôt faute de fd (EMFILE / ENFILE)
+    uint64_t accept_errors;     // autres erreurs de accept4
+    uint64_t budget_exhausted;  // lots d'accept interrompus par le budget, repris à l'itération suivante
+    uint64_t paused;            // mises en pause d'un listener sur limite de connexions
+    size_t active;              // connexions ouvertes
+};
+
+// Limite globale de connexions partagée par les Acceptors d'un TcpServer, et compteurs d'admission.
+// Le contrôle est fait avant accept4 sur chaque boucle : la limite peut être dépassée d'au plus une connexion par boucle.
+class AdmissionControl : notcopyable
+{
+private:
+    const size_t m_max_connections; // 0 : illimité
+    std::atomic<size_t> m_active{0};
+
+    std::atomic<uint64_t> m_accepted{0};
+    std::atomic<uint64_t> m_rejected_no_fd{0};
+    std::atomic<uint64_t> m_accept_errors{0};
+    std::atomic<uint64_t> m_budget_exhausted{0};
+    std::atomic<uint64_t> m_paused{0};
+
+    std::mutex m_mutex;
+    std::vector<Acceptor *> m_parked; // Acceptors en attente de place globale
+    std::atomic<bool> m_has_parked{false};
+
+    void resume_parked();
+
+public:
+    explicit AdmissionControl(size_t max_connections) : m_max_connections(max_connections) {}
+
+    [[nodiscard]] bool has_room() const
+    {
+        return m_max_connections == 0 || m_active.load(std::memory_order_relaxed) < m_max_connections;
+    }
+
+    void admitted()
+    {
+        m_active.fetch_add(1, std::memory_order_relaxed);
+        m_accepted.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // une connexion admise s'est fermée : réveille les Acceptors en attente s'il y a de nouveau de la place
+    void released();
+
+    // l'Acceptor est en pause faute de place globale, il sera relancé dans sa boucle par released()
+    void park(Acceptor *acceptor);
+
+    void unpark(Acceptor *acceptor);
+
+    void count_rejected_no_fd() { m_rejected_no_fd.fetch_add(1, std::memory_order_relaxed); }
+
+    void count_accept_error() { m_accept_errors.fetch_add(1, std::memory_order_relaxed); }
+
+    void count_budget_exhausted() { m_budget_exhausted.fetch_add(1, std::memory_order_relaxed); }
+
+    void count_paused() { m_paused.fetch_add(1, std::memory_order_relaxed); }
+
+    [[nodiscard]] AdmissionStats stats() const;
+};
+
+#endif // TKS_ADMISSION_CONTROL
@@ -0,0 +1,56 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_BROADCAST_GROUP)
+#define TKS_BROADCAST_GROUP
+
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+
+#include "fastlog/not_copyable.hpp"
+
+class EventLoop;
+class TcpConnection;
+class ProtoBuffer;
+class SharedPayload;
+
+// Groupe de diffusion réparti sur les boucles : chaque boucle ne touche qu'à ses propres membres.
+// publish() crée un seul payload partagé et poste une seule tâche par boucle, quel que soit le nombre d'abonnés.
+// Toutes les méthodes sont thread-safe. Une connexion migrée (TcpConnection::migrate_to) reste membre dans la boucle
+// où elle a rejoint le groupe, qui lui relaie les payloads.
+class BroadcastGroup : notcopyable
+{
+private:
+    struct LoopMembers
+    {
+        EventLoop *loop;
+        std::unordered_map<long, std::weak_ptr<TcpConnection>> members; // accédé uniquement dans le thread de loop
+        std::atomic<size_t> count{0};
+    };
+
+    std::vector<std::shared_ptr<LoopMembers>> m_loops;
+
+    [[nodiscard]] std::shared_ptr<LoopMembers> members_of(EventLoop *loop) const;
+
+public:
+    explicit BroadcastGroup(std::vector<EventLoop *> const &loops);
+
+    void join(std::shared_ptr<TcpConnection> const &conn);
+
+    void leave(std::shared_ptr<TcpConnection> const &conn);
+
+    // copie buffer une seule fois, l'appelant garde la propriété de buffer
+    void publish(ProtoBuffer *buffer);
+
+    void publish(std::shared_ptr<const SharedPayload> const &payload);
+
+    // approximatif : les connexions fermées ne sont retirées qu'au prochain publish
+    [[nodiscard]] size_t member_count() const;
+};
+
+#endif // TKS_BROADCAST_GROUP
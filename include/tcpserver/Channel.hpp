@@ -9,18 +9,37 @@
 
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <sys/epoll.h>
 
 #include "fastlog/not_copyable.hpp"
 
 class EventLoop;
 
-enum class ChannelMark {
+enum class ChannelMark : uint8_t {
     NEW,
     ADDED,
     DELETED
 };
 
+// Destinataire des événements d'un Channel sans passer par des std::function : un seul pointeur par canal.
+// Utilisé par TcpConnection, dont des millions d'instances peuvent être inactives en même temps.
+class ChannelHandler {
+public:
+    virtual void on_channel_read(int64_t receive_time) = 0;
+
+    virtual void on_channel_write() = 0;
+
+    virtual void on_channel_close() = 0;
+
+    virtual void on_channel_error() = 0;
+
+    virtual void on_channel_periodic(int64_t now) = 0;
+
+protected:
+    ~ChannelHandler() = default;
+};
+
 // Un canal d'E/S sélectionnable.
 // Chaque objet Channel appartient à un seul thread IO, chaque canal
 // L'objet est uniquement responsable de la distribution de l'événement IO d'un descripteur de fichier fd du début à la fin,
@@ -45,11 +64,22 @@ public:
         update();
     }
 
+    void disable_reading(){
+        m_events_flag &= ~kReadEvent;
+        update();
+    }
+
     void disable_write(){
         m_events_flag &= ~kWriteEvent;
         update();
     }
 
+    // une seule mise à jour pour les deux, voir TcpConnection en mode EPOLLOUT permanent
+    void enable_reading_and_writing(){
+        m_events_flag |= kReadEvent | kWriteEvent;
+        update();
+    }
+
     void disable_all(){
         m_events_flag = kNoneEvent;
         update();
@@ -64,6 +94,10 @@ public:
         return m_events_flag & kWriteEvent;
     }
 
+    [[nodiscard]] bool is_reading() const {
+        return m_events_flag & kReadEvent;
+    }
+
     [[nodiscard]] bool supports_pn() const { return m_with_pn; }
 
     // for poller
@@ -79,21 +113,55 @@ public:
 
     [[nodiscard]] EventLoop *owner_loop() const { return m_loop; }
 
-    void set_read_cb(std::function<void(int64_t)> const &cb) { m_read_cb = cb; }
+    // Migration vers une autre boucle (TcpConnection::migrate_to) : le canal doit avoir été retiré de l'EventManager
+    // de la boucle actuelle, il sera ajouté à celui de loop à la prochaine mise à jour
+    void move_to(EventLoop *loop);
 
-    void set_write_cb(std::function<void()> const &cb) { m_write_cb = cb; }
+    // Le handler passe avant les callbacks. Il doit survivre au Channel.
+    void set_handler(ChannelHandler *handler) { m_handler = handler; }
 
-    void set_error_cb(std::function<void()> const &cb) { m_error_cb = cb; }
+    void set_read_cb(std::function<void(int64_t)> const &cb) { callbacks()->read = cb; }
 
-    void set_close_cb(std::function<void()> const &cb) { m_close_cb = cb; }
+    void set_write_cb(std::function<void()> const &cb) { callbacks()->write = cb; }
 
-    void set_periodic_notification_cb(std::function<void(uint64_t)> const &cb) { m_periodic_notification_cb = cb; }
+    void set_error_cb(std::function<void()> const &cb) { callbacks()->error = cb; }
+
+    void set_close_cb(std::function<void()> const &cb) { callbacks()->close = cb; }
+
+    void set_periodic_notification_cb(std::function<void(uint64_t)> const &cb) { callbacks()->periodic_notification = cb; }
+
+    // index dans la liste des observateurs périodiques de l'EventManager, -1 si absent
+    void pn_index(int32_t index) { m_pn_index = index; }
+
+    [[nodiscard]] int32_t pn_index() const { return m_pn_index; }
 
     void set_revents(uint32_t revents) {
         m_revents = revents;
     }
 
+    // for poller : modification en attente (voir EventManager::flush_updates)
+    [[nodiscard]] bool update_pending() const { return m_update_pending; }
+
+    void update_pending(bool pending) { m_update_pending = pending; }
+
+    // Avant le premier enable_* : fd partagé par les epoll de plusieurs boucles (listener AF_UNIX dupliqué), un
+    // événement ne réveille qu'une d'entre elles (EPOLLEXCLUSIVE). Ces canaux ne passent jamais par EPOLL_CTL_MOD.
+    void set_exclusive_wakeup(bool exclusive) { m_exclusive = exclusive; }
+
+    [[nodiscard]] bool exclusive_wakeup() const { return m_exclusive; }
+
 private:
+    // alloués seulement pour les canaux sans handler (listeners, timers, waker...)
+    struct Callbacks {
+        std::function<void(int64_t)> read;
+        std::function<void()> write;
+        std::function<void()> error;
+        std::function<void()> close;
+        std::function<void(uint64_t)> periodic_notification;
+    };
+
+    Callbacks *callbacks();
+
     void update();
 
     static const uint32_t kReadEvent;
@@ -102,18 +170,16 @@ private:
 
 private:
     EventLoop *m_loop;
+    ChannelHandler *m_handler{nullptr};
+    std::unique_ptr<Callbacks> m_callbacks;
     const int m_fd;
-    bool m_with_pn;
-
     uint32_t m_events_flag{0};
-    ChannelMark m_mark; // used by Poller
-
-    std::function<void(int64_t)> m_read_cb;
-    std::function<void()> m_write_cb;
-    std::function<void()> m_error_cb;
-    std::function<void()> m_close_cb;
-    std::function<void(uint64_t)> m_periodic_notification_cb;
     uint32_t m_revents{0};
+    int32_t m_pn_index{-1};
+    ChannelMark m_mark; // used by Poller
+    bool m_with_pn;
+    bool m_update_pending{false};
+    bool m_exclusive{false};
 };
 
 #endif // TKS_CHANNEL
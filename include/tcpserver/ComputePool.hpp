@@ -0,0 +1,160 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_COMPUTE_POOL)
+#define TKS_COMPUTE_POOL
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "fastlog/not_copyable.hpp"
+#include "EventLoop.hpp"
+#include "TcpConnection.hpp"
+
+struct ComputePoolStats
+{
+    uint64_t submitted;  // tâches soumises
+    uint64_t executed;   // tâches exécutées
+    uint64_t stolen;     // tâches prises dans la file d'un autre worker
+    uint64_t cancelled;  // tâches abandonnées : connexion fermée avant exécution ou avant la continuation
+    uint64_t pending;    // tâches en file, tous workers confondus
+    uint64_t max_depth;  // plus grande profondeur observée d'une file de worker
+};
+
+// Exécuteur à vol de tâches pour sortir les traitements lourds (crypto, compression, mise en forme de résultats)
+// des boucles réseau. Chaque worker a sa file : il dépile par la fin (LIFO, données encore en cache), les workers
+// inoccupés volent par le début. Les soumissions hors pool sont réparties en round-robin.
+// Le pool doit survivre aux boucles qui exécutent ses continuations.
+class ComputePool : notcopyable
+{
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+        std::thread thread;
+    };
+
+    const uint32_t m_num_workers;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<uint32_t> m_next{0};
+
+    // sommeil des workers sans tâche
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_wakeup;
+    std::atomic<uint32_t> m_idle{0};
+    std::atomic<uint64_t> m_pending{0};
+    bool m_running{false};
+    std::atomic<bool> m_stop{false};
+
+    std::atomic<uint64_t> m_submitted{0};
+    std::atomic<uint64_t> m_executed{0};
+    std::atomic<uint64_t> m_stolen{0};
+    std::atomic<uint64_t> m_cancelled{0};
+    std::atomic<uint64_t> m_max_depth{0};
+
+    void run(uint32_t index);
+
+    bool take(uint32_t index, std::function<void()> *task);
+
+    void push(uint32_t index, std::function<void()> task);
+
+    // fn est postée dans la boucle de la connexion à la soumission, qui la relaie (TcpConnection::run_in_loop) si
+    // la connexion a migré entre-temps
+    static void post_continuation(std::weak_ptr<TcpConnection> const &weak, EventLoop *loop, std::function<void()> fn)
+    {
+        loop->queue([weak, fn = std::move(fn)]
+        {
+            auto self = weak.lock();
+            if (self == nullptr)
+            {
+                fn();
+                return;
+            }
+            self->run_in_loop(fn);
+        });
+    }
+
+public:
+    explicit ComputePool(uint32_t num_workers = std::thread::hardware_concurrency());
+
+    ~ComputePool();
+
+    void start();
+
+    // les tâches encore en file sont abandonnées
+    void stop();
+
+    [[nodiscard]] uint32_t size() const { return m_num_workers; }
+
+    // Depuis un worker, la tâche va dans sa propre file ; sinon dans celle du worker suivant.
+    void submit(std::function<void()> task);
+
+    // Exécute work sur le pool puis done(conn, résultat) dans la boucle de conn, par EventLoop::queue() (la boucle
+    // actuelle de conn si elle a migré entre-temps).
+    // Si la connexion est fermée avant l'exécution ou avant la continuation, l'étape restante est abandonnée
+    // (compteur cancelled) : le pool ne garde qu'un weak_ptr et ne retarde pas la destruction de la connexion.
+    template<typename Work, typename Done>
+    void submit(std::shared_ptr<TcpConnection> const &conn, Work work, Done done);
+
+    void count_cancelled() { m_cancelled.fetch_add(1, std::memory_order_relaxed); }
+
+    [[nodiscard]] ComputePoolStats stats() const;
+};
+
+template<typename Work, typename Done>
+void ComputePool::submit(std::shared_ptr<TcpConnection> const &conn, Work work, Done done)
+{
+    std::weak_ptr<TcpConnection> weak = conn;
+    EventLoop *loop = conn->event_loop();
+    submit([this, weak, loop, work = std::move(work), done = std::move(done)]() mutable {
+        // expired() et non lock() : le worker ne doit jamais tenir la dernière référence et détruire la connexion
+        if (weak.expired())
+        {
+            count_cancelled();
+            return;
+        }
+
+        using Result = std::invoke_result_t<Work &>;
+        if constexpr (std::is_void_v<Result>)
+        {
+            work();
+            post_continuation(weak, loop, [this, weak, done = std::move(done)]() mutable {
+                auto self = weak.lock();
+                if (self == nullptr || !self->is_connected())
+                {
+                    count_cancelled();
+                    return;
+                }
+                done(self);
+            });
+        }
+        else
+        {
+            // std::function exige une continuation copiable : le résultat est partagé
+            auto result = std::make_shared<Result>(work());
+            post_continuation(weak, loop, [this, weak, result, done = std::move(done)]() mutable {
+                auto self = weak.lock();
+                if (self == nullptr || !self->is_connected())
+                {
+                    count_cancelled();
+                    return;
+                }
+                done(self, std::move(*result));
+            });
+        }
+    });
+}
+
+#endif // TKS_COMPUTE_POOL
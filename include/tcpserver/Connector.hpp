@@ -0,0 +1,89 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_CONNECTOR)
+#define TKS_CONNECTOR
+
+#include <memory>
+#include <functional>
+#include <string>
+#include <sys/socket.h>
+
+#include "fastlog/not_copyable.hpp"
+
+class EventLoop;
+class Channel;
+class Timer;
+
+// Connexion sortante non bloquante : connect() sur la boucle, attente de EPOLLOUT,
+// puis remise du fd connecté via le callback. Les échecs sont retentés avec un backoff exponentiel.
+// Toutes les méthodes (sauf le constructeur) doivent être appelées dans le thread de la boucle.
+class Connector : notcopyable
+{
+private:
+    enum StateE {
+        kDisconnected,
+        kConnecting,
+        kConnected,
+    };
+
+    EventLoop *m_loop;
+    sockaddr_storage m_addr{};
+    socklen_t m_addr_len;
+    StateE m_state{kDisconnected};
+    bool m_connect{false};
+
+    // in ms
+    uint32_t m_init_retry_delay{500};
+    uint32_t m_max_retry_delay{30'000};
+    uint32_t m_retry_delay{500};
+    int64_t m_connected_time{0}; // dernière connexion établie, en ms (horloge de la boucle)
+
+    std::unique_ptr<Channel> m_channel;
+    std::unique_ptr<Timer> m_retry_timer;
+    std::function<void(int sock_fd)> m_new_connection_cb;
+
+    void connect();
+
+    void connecting(int sock_fd);
+
+    void handle_write();
+
+    void handle_error();
+
+    void retry(int sock_fd);
+
+    int remove_and_reset_channel();
+
+public:
+    Connector(EventLoop *loop, const sockaddr *addr, socklen_t addr_len);
+
+    ~Connector();
+
+    void set_on_connected(std::function<void(int sock_fd)> const &cb) { m_new_connection_cb = cb; }
+
+    void set_retry_delay(uint32_t init_ms, uint32_t max_ms);
+
+    void start();
+
+    // À appeler après la perte d'une connexion établie : reconnexion immédiate avec le délai initial si elle a tenu
+    // au moins CONNECTOR_STABLE_MS, sinon nouvelle tentative après le délai courant, qui continue de doubler
+    void restart();
+
+    void stop();
+
+    [[nodiscard]] const sockaddr *address() const { return (const sockaddr *) &m_addr; }
+
+    [[nodiscard]] socklen_t address_len() const { return m_addr_len; }
+
+    // Remplit addr pour une ip littérale (IPv4 ou IPv6). Retourne 0 si l'ip est invalide.
+    static socklen_t make_inet_address(const std::string &ip, uint16_t port, sockaddr_storage *addr);
+
+    // Remplit addr pour un socket Unix, '@' en tête désigne l'espace de noms abstrait. Retourne 0 si path est invalide.
+    static socklen_t make_unix_address(const std::string &path, sockaddr_storage *addr);
+};
+
+#endif // TKS_CONNECTOR
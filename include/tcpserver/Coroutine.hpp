@@ -0,0 +1,132 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_COROUTINE)
+#define TKS_COROUTINE
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+class TcpConnection;
+class ProtoBuffer;
+class Timer;
+
+// Allocateur de frames de coroutine par thread de boucle : listes libres par classe de taille,
+// les frames sont recyclées sans repasser par malloc.
+class CoFrameAllocator
+{
+public:
+    static void *allocate(size_t size);
+
+    static void deallocate(void *ptr, size_t size);
+};
+
+// Coroutine de gestion de connexion, démarrée immédiatement et autonome (pas de handle à conserver).
+// Les reprises se font toujours dans le thread de la boucle de la connexion, sans réveil supplémentaire.
+//
+//   ConnTask session(TcpConnection *conn) {
+//       auto hello = co_await conn->read_until("\r\n");
+//       if (!hello) co_return; // connexion fermée
+//       ...
+//   }
+//
+// À lancer depuis le callback de changement d'état (connexion établie) : dès qu'une attente est créée,
+// les données reçues sont gardées pour la coroutine et ne passent plus par le data callback.
+// À la fermeture, l'attente en cours est reprise et les suivantes rendent la main tout de suite : la coroutine va
+// jusqu'au bout. Une connexion détruite sans fermeture (arrêt du serveur) détruit la coroutine suspendue ; la frame
+// ne doit donc pas garder de shared_ptr vers sa connexion, qui ne serait alors jamais détruite.
+class ConnTask
+{
+public:
+    struct promise_type
+    {
+        ConnTask get_return_object() noexcept { return {}; }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() noexcept;
+
+        static void *operator new(size_t size) { return CoFrameAllocator::allocate(size); }
+
+        static void operator delete(void *ptr, size_t size) { CoFrameAllocator::deallocate(ptr, size); }
+    };
+};
+
+// co_await conn->read_exactly(n) / read_until(delim) : vue sur les octets lus, valide jusqu'à la lecture suivante.
+// std::nullopt si la connexion est fermée avant que la condition soit remplie.
+class ReadAwaiter
+{
+private:
+    friend class TcpConnection;
+
+    TcpConnection *m_conn;
+    uint32_t m_exactly;
+    std::string m_delimiter;
+    std::optional<std::string_view> m_result;
+
+    bool try_complete();
+
+public:
+    ReadAwaiter(TcpConnection *conn, uint32_t exactly, std::string_view delimiter);
+
+    bool await_ready();
+
+    void await_suspend(std::coroutine_handle<> handle);
+
+    std::optional<std::string_view> await_resume() { return m_result; }
+};
+
+// co_await conn->write(buffer) : reprend quand tout ce qui était en file est parti dans le socket.
+// false si la connexion est fermée entre-temps. La connexion devient propriétaire de buffer.
+class WriteAwaiter
+{
+private:
+    TcpConnection *m_conn;
+    ProtoBuffer *m_buffer;
+    bool m_result{false};
+
+    friend class TcpConnection;
+
+public:
+    WriteAwaiter(TcpConnection *conn, ProtoBuffer *buffer) : m_conn(conn), m_buffer(buffer) {}
+
+    bool await_ready();
+
+    void await_suspend(std::coroutine_handle<> handle);
+
+    bool await_resume() const { return m_result; }
+};
+
+// co_await conn->sleep(ms) : Timer sur la boucle de la connexion, interrompu par la fermeture de la connexion
+class SleepAwaiter
+{
+private:
+    TcpConnection *m_conn;
+    uint32_t m_ms;
+    std::unique_ptr<Timer> m_timer;
+
+public:
+    SleepAwaiter(TcpConnection *conn, uint32_t ms);
+
+    ~SleepAwaiter();
+
+    bool await_ready() const;
+
+    void await_suspend(std::coroutine_handle<> handle);
+
+    void await_resume() const {}
+};
+
+#endif // TKS_COROUTINE
@@ -10,20 +10,64 @@
 #include <thread>
 #include <mutex>
 #include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
 
 #include "fastlog/not_copyable.hpp"
+#include "SpscRing.hpp"
+#include "LatencyHistogram.hpp"
 
+// taille maximale d'une lecture, et donc du buffer de lecture de la boucle
 #define READ_BUFFER_SIZE (2 * 1024 * 1024)
+#define WRITE_BUFFER_SIZE (256 * 1024)
+// bornes de la taille de lecture adaptative de chaque connexion
+#define READ_SIZE_MIN 2048
+#define READ_SIZE_INITIAL 16384
+// délai sans trafic après lequel une connexion rend ses buffers, 0 : jamais
+#define IDLE_TRIM_SECONDS 30
+// lecture maximale d'une connexion par réveil avant de laisser passer les autres, 0 : illimité
+#define READ_BUDGET_BYTES (1024 * 1024)
+#define READ_BUDGET_CALLS 32
+// plafond du SO_RCVLOWAT posé pour attendre une trame (TcpConnection::await_frame_bytes)
+#define RCVLOWAT_MAX (1024 * 1024)
 
 class EventManager;
 class Channel;
 class AsyncWaker;
 class ProtoBuffer;
 class EventObject;
+class RingPool;
+class TcpConnection;
 
+// file d'une boucle source vers une boucle cible, voir EventLoopThreadPool::send()
+using LoopMailbox = SpscRing<std::function<void()>>;
+
+// octets lus par une connexion pendant une fenêtre d'échantillonnage, voir EventLoop::take_traffic()
+struct TrafficSample {
+    std::weak_ptr<TcpConnection> conn;
+    uint64_t bytes;
+};
+
+struct TrafficWindow {
+    uint64_t total_bytes{0};
+    std::vector<TrafficSample> top; // octets décroissants
+};
 
 class EventLoop : notcopyable
 {
+public:
+    // ce que la boucle exécute, voir activity() : un fd >= 0 pendant les callbacks de son Channel, sinon une phase
+    enum : int {
+        kActivityIdle = -1,
+        kActivityTimers = -2,
+        kActivityDeferred = -3,
+        kActivityPendingQueue = -4,
+        kActivityInboxes = -5,
+        kActivityPeriodic = -6,
+    };
+
 private:
     bool m_looping;
     const std::thread::id m_thread_id;
@@ -32,12 +76,63 @@ private:
     std::unique_ptr<EventManager> m_event_manager;
     std::atomic<bool> m_quit{false};
     std::vector<std::function<void()>> m_run_queue;
+    // travail reporté à l'itération suivante, thread de la boucle uniquement
+    std::vector<std::function<void()>> m_next_iteration;
 
     void do_pending_queue();
     std::atomic<bool> m_calling_pending_queue{false};
     std::unique_ptr<AsyncWaker> m_async_waker;
 
+    // files SPSC entrantes, une par boucle source du pool
+    std::vector<LoopMailbox *> m_inboxes;
+    // vrai pendant epoll_wait : un producteur qui le voit doit réveiller la boucle
+    std::atomic<bool> m_polling{false};
+    int m_pool_index{-1};
+    bool drain_inboxes();
+    bool has_inbox_items();
+
+    // scratch de lecture et d'écriture séparés : une écriture ne ramène pas en cache les pages de la lecture
     ProtoBuffer *m_network_buffer{nullptr};
+    ProtoBuffer *m_send_buffer{nullptr};
+    std::unique_ptr<RingPool> m_ring_pool;
+    uint32_t m_read_buffer_size{READ_BUFFER_SIZE};
+    uint32_t m_write_buffer_size{WRITE_BUFFER_SIZE};
+    uint32_t m_read_size_min{READ_SIZE_MIN};
+    uint32_t m_read_size_initial{READ_SIZE_INITIAL};
+    uint32_t m_read_budget_bytes{READ_BUDGET_BYTES};
+    uint32_t m_read_budget_calls{READ_BUDGET_CALLS};
+    bool m_sticky_write_interest{false};
+
+    std::atomic<uint32_t> m_idle_trim_ms{IDLE_TRIM_SECONDS * 1000};
+    std::atomic<uint64_t> m_idle_trims{0};
+    std::atomic<uint64_t> m_idle_reclaimed_bytes{0};
+    // écrits par la boucle seule, lisibles depuis n'importe quel thread
+    std::atomic<uint64_t> m_read_wakeups{0};
+    std::atomic<uint64_t> m_rcvlowat_arms{0};
+
+    // charge, pour le rééquilibrage des connexions (TcpServer::enable_balancer) : temps passé hors epoll_wait,
+    // et octets lus par connexion depuis le dernier take_traffic() quand l'échantillonnage est actif
+    std::atomic<uint64_t> m_busy_ns{0};
+    bool m_traffic_sampling{false};
+    uint64_t m_traffic_bytes{0};
+    std::unordered_map<long, TrafficSample> m_traffic;
+
+    // créés à la première connexion tracée, lisibles depuis n'importe quel thread
+    std::atomic<LatencyStats *> m_latency_stats{nullptr};
+
+    // horloge de la boucle, lue une fois après chaque epoll_wait (voir now()) ; atomiques pour les lectures
+    // depuis d'autres threads, relaxed : un load simple
+    std::atomic<int64_t> m_now_ns{0};
+    std::atomic<int64_t> m_wall_offset_ms{0}; // TimeUtils - CLOCK_MONOTONIC, recalé chaque seconde
+    int64_t m_next_calibration_ns{0};
+
+    void update_clock();
+
+    // lus par LoopWatchdog depuis son thread : quelques stores relaxed par itération
+    std::atomic<uint64_t> m_heartbeat{0};
+    std::atomic<int64_t> m_busy_since_ms{0}; // 0 pendant epoll_wait
+    std::atomic<int> m_activity{kActivityIdle};
+    pthread_t m_native_thread{};
     std::list<EventObject *> m_events;
     int call_events(int64_t now);
     void abortNotInLoopThread() const;
@@ -60,6 +155,10 @@ public:
     // mettre le to_run dans la file d'attente et réveiller le thread IO si nécessaire
     void queue(std::function<void()> const &to_run);
 
+    // À appeler dans le thread de la boucle : to_run sera exécuté à l'itération suivante, après les événements
+    // de cette itération. epoll_wait ne bloque pas tant que cette file n'est pas vide.
+    void queue_next_iteration(std::function<void()> const &to_run);
+
     void assertInLoopThread()
     {
         if (!isInLoopThread())
@@ -68,8 +167,124 @@ public:
         }
     }
 
+    // buffer de lecture partagé par les connexions de la boucle, passé au data callback
     ProtoBuffer *network_buffer();
 
+    // buffer d'écriture partagé, utilisé pour vider les ByteStream sortants
+    ProtoBuffer *send_buffer();
+
+    // rings d'entrée libérées par les connexions de la boucle, voir TcpConnection::enable_input_ring()
+    RingPool *ring_pool();
+
+    // Avant la première E/S de la boucle. read_max borne une lecture (et la taille du buffer de lecture), les
+    // connexions commencent à read_initial octets puis s'adaptent entre read_min et read_max selon leurs lectures.
+    void set_read_sizes(uint32_t read_min, uint32_t read_initial, uint32_t read_max);
+
+    void set_write_buffer_size(uint32_t size);
+
+    // Une connexion qui a lu bytes octets ou appelé calls fois le data callback rend la main ; sa lecture reprend
+    // à l'itération suivante, sans attendre epoll (voir queue_next_iteration). 0 : pas de limite. Avant les
+    // premières connexions ou dans le thread de la boucle.
+    void set_read_budget(uint32_t bytes, uint32_t calls)
+    {
+        m_read_budget_bytes = bytes;
+        m_read_budget_calls = calls;
+    }
+
+    [[nodiscard]] uint32_t read_budget_bytes() const { return m_read_budget_bytes; }
+
+    [[nodiscard]] uint32_t read_budget_calls() const { return m_read_budget_calls; }
+
+    // Les connexions établies ensuite gardent EPOLLOUT enregistré en permanence : plus d'epoll_ctl à chaque écriture
+    // ni à chaque vidage, un EPOLLOUT sans rien à envoyer est ignoré. Avant les premières connexions.
+    void set_sticky_write_interest(bool sticky) { m_sticky_write_interest = sticky; }
+
+    [[nodiscard]] bool sticky_write_interest() const { return m_sticky_write_interest; }
+
+    // appels à epoll_ctl de cette boucle, lisible depuis n'importe quel thread
+    [[nodiscard]] uint64_t epoll_ctl_calls() const;
+
+    [[nodiscard]] uint32_t read_size_min() const { return m_read_size_min; }
+
+    [[nodiscard]] uint32_t read_size_initial() const { return m_read_size_initial; }
+
+    [[nodiscard]] uint32_t read_size_max() const { return m_read_buffer_size; }
+
+    // Les connexions sans trafic depuis seconds libèrent leurs buffers de sortie (ByteStream, file de broadcast) et
+    // d'entrée coroutine ; ils sont réalloués à la prochaine écriture. 0 désactive. Appelable depuis n'importe quel thread.
+    void set_idle_trim(uint32_t seconds) { m_idle_trim_ms.store(seconds * 1000, std::memory_order_relaxed); }
+
+    [[nodiscard]] uint32_t idle_trim_ms() const { return m_idle_trim_ms.load(std::memory_order_relaxed); }
+
+    // EPOLLIN traités par les connexions, et SO_RCVLOWAT posés pour attendre une trame entière :
+    // read_wakeups() rapporté au nombre de messages de l'application donne les réveils par message
+    void count_read_wakeup() { m_read_wakeups.store(m_read_wakeups.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+    void count_rcvlowat_arm() { m_rcvlowat_arms.store(m_rcvlowat_arms.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+    [[nodiscard]] uint64_t read_wakeups() const { return m_read_wakeups.load(std::memory_order_relaxed); }
+
+    [[nodiscard]] uint64_t rcvlowat_arms() const { return m_rcvlowat_arms.load(std::memory_order_relaxed); }
+
+    // temps cumulé hors epoll_wait (callbacks, timers, files), lisible depuis n'importe quel thread : sa dérivée
+    // donne l'occupation de la boucle
+    [[nodiscard]] uint64_t busy_ns() const { return m_busy_ns.load(std::memory_order_relaxed); }
+
+    // Thread de la boucle : compte les octets lus par chaque connexion jusqu'au prochain take_traffic()
+    void set_traffic_sampling(bool sampling);
+
+    [[nodiscard]] bool traffic_sampling() const { return m_traffic_sampling; }
+
+    void record_traffic(TcpConnection *conn, uint64_t bytes);
+
+    // Thread de la boucle : les top_count connexions qui ont le plus lu depuis l'appel précédent, et le total de la
+    // boucle. La fenêtre repart de zéro.
+    TrafficWindow take_traffic(size_t top_count);
+
+    // thread de la boucle : une connexion vient de rendre bytes octets
+    void record_idle_trim(size_t bytes)
+    {
+        m_idle_trims.fetch_add(1, std::memory_order_relaxed);
+        m_idle_reclaimed_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    // nombre de libérations et octets rendus : blocs libérés (ByteStream, file de broadcast avec ses nœuds, entrée
+    // coroutine) et capacité des rings rendues au pool
+    [[nodiscard]] uint64_t idle_trims() const { return m_idle_trims.load(std::memory_order_relaxed); }
+
+    [[nodiscard]] uint64_t idle_reclaimed_bytes() const { return m_idle_reclaimed_bytes.load(std::memory_order_relaxed); }
+
+    // histogrammes de latence des connexions tracées de cette boucle, nullptr si aucune ne l'a été
+    [[nodiscard]] const LatencyStats *latency_stats() const { return m_latency_stats.load(std::memory_order_acquire); }
+
+    // thread de la boucle : crée les histogrammes si besoin
+    LatencyStats *enable_latency_stats();
+
+    // Pour LoopWatchdog. heartbeat : itérations depuis le démarrage ; busy_since_ms : début du travail en cours
+    // (CLOCK_MONOTONIC), 0 si la boucle attend dans epoll_wait ; activity : fd ou phase en cours d'exécution.
+    [[nodiscard]] uint64_t heartbeat() const { return m_heartbeat.load(std::memory_order_relaxed); }
+
+    [[nodiscard]] int64_t busy_since_ms() const { return m_busy_since_ms.load(std::memory_order_acquire); }
+
+    [[nodiscard]] int activity() const { return m_activity.load(std::memory_order_relaxed); }
+
+    // thread qui exécute loop(), valide une fois la boucle démarrée
+    [[nodiscard]] pthread_t native_thread() const { return m_native_thread; }
+
+    // Instant (CLOCK_MONOTONIC, en ns) du dernier retour d'epoll_wait. Lu une fois par itération : les callbacks
+    // d'une même itération voient la même valeur, sans appel d'horloge. Pour une durée fine dans un callback,
+    // latency_clock_ns().
+    [[nodiscard]] int64_t now() const { return m_now_ns.load(std::memory_order_relaxed); }
+
+    // now() en millisecondes dans la base de TimeUtils::current_time_in_millis(), pour les délais et les receive_time
+    [[nodiscard]] int64_t now_ms() const
+    {
+        return m_wall_offset_ms.load(std::memory_order_relaxed) + m_now_ns.load(std::memory_order_relaxed) / 1000000;
+    }
+
+    // retour d'epoll_wait pour le traçage de latence, même base que latency_clock_ns()
+    [[nodiscard]] int64_t poll_return_ns() const { return now(); }
+
     // Déterminez s'il se trouve dans le fil de la boucle
     [[nodiscard]] bool isInLoopThread() const
     {
@@ -80,9 +295,25 @@ public:
 
     void remove_channel(Channel *channel);
 
+    // canal sans événement, suivi pour les notifications périodiques (voir EventManager::register_channel)
+    void register_channel(Channel *channel);
+
     void schedule_event(EventObject *, uint32_t timeout);
 
     void remove_event(const EventObject *);
+
+    // boucle du thread courant, nullptr si le thread n'en a pas
+    static EventLoop *current();
+
+    // À appeler dans le thread de la boucle
+    void attach_inbox(LoopMailbox *inbox);
+
+    // producteur : à appeler après un push dans une inbox de cette boucle
+    void notify_inbox();
+
+    void pool_index(int index) { m_pool_index = index; }
+
+    [[nodiscard]] int pool_index() const { return m_pool_index; }
 };
 
 #endif // EVENT_LOOP
@@ -18,13 +18,15 @@ class EventLoopThread : notcopyable
 public:
     EventLoopThread();
     ~EventLoopThread();
-    EventLoop *startLoop();
+    // pool_index : position de la boucle dans son EventLoopThreadPool, fixée avant qu'elle ne tourne
+    EventLoop *startLoop(int pool_index = -1);
 
 private:
     void threadFunc();
 
     EventLoop *m_loop;
     bool m_exiting;
+    int m_pool_index{-1};
     std::thread m_thread;
     std::mutex m_mutex;
     std::condition_variable m_cond;
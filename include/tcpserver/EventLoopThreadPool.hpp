@@ -3,8 +3,10 @@
 //
 
 #include "fastlog/not_copyable.hpp"
+#include "SpscRing.hpp"
 #include <vector>
 #include <memory>
+#include <functional>
 
 class EventLoop;
 
@@ -24,12 +26,26 @@ public:
 
     EventLoop *get_next_loop();
 
+    // taille de chaque file entre deux boucles, à fixer avant start()
+    void set_mailbox_capacity(uint32_t capacity) { m_mailbox_capacity = capacity; }
+
+    // Envoie task à la boucle to par la file SPSC (boucle courante -> to), exécutée par lots une fois par itération.
+    // Retourne false si la file est pleine : à l'appelant de ralentir ou de réessayer.
+    // Depuis un thread hors du pool, ou vers la boucle courante, on passe par EventLoop::queue() (non borné).
+    bool send(EventLoop *to, std::function<void()> task);
+
+    // boucles du pool, vide avant start()
+    [[nodiscard]] const std::vector<EventLoop *> &loops() const { return m_loops; }
+
 private:
     EventLoop *m_base_loop;
     bool m_started;
     uint32_t m_num_threads;
     uint32_t m_next;
+    uint32_t m_mailbox_capacity{1024};
 
+    // m_mailboxes[from * n + to], détruites après l'arrêt des threads
+    std::vector<std::unique_ptr<SpscRing<std::function<void()>>>> m_mailboxes;
     std::vector<std::unique_ptr<EventLoopThread>> m_threads;
     std::vector<EventLoop *> m_loops;
 };
\ No newline at end of file
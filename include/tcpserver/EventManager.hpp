@@ -5,9 +5,10 @@
 #if !defined(TKS_EVENT_MANAGER)
 #define TKS_EVENT_MANAGER
 
-#include <unordered_map>
 #include <vector>
 #include <cstdint>
+#include <cstddef>
+#include <atomic>
 
 class EventLoop;
 class Channel;
@@ -18,22 +19,37 @@ private:
     EventLoop *m_owner_loop;
     int m_epoll_fd;
     std::vector<struct epoll_event> m_event_list;
-    std::unordered_map<int, Channel *> m_channels;
-    std::unordered_map<int, Channel *> m_periodic_notification_observers;
+    // liste dense, chaque Channel connaît sa position (Channel::pn_index) pour un retrait en O(1)
+    std::vector<Channel *> m_periodic_notification_observers;
+    // EPOLL_CTL_MOD reportés à la fin de l'itération : un seul appel par fd
+    std::vector<Channel *> m_pending_updates;
+    std::atomic<uint64_t> m_epoll_ctl_calls{0};
 
 public:
     explicit EventManager(EventLoop *loop);
     ~EventManager();
 
-    int64_t epoll(int timeout_ms, std::vector<Channel *> *channels);
+    void epoll(int timeout_ms, std::vector<Channel *> *channels);
 
     void updateChannel(Channel *channel);
     void remove_channel(Channel *channel);
+    // inscrit un canal sans événement (notifications périodiques seulement), sans epoll_ctl : le premier
+    // enable_* fera l'EPOLL_CTL_ADD
+    void register_channel(Channel *channel);
 
-    void check_periodic_observers();
+    void check_periodic_observers(int64_t now);
+
+    // applique les modifications reportées, appelé avant chaque epoll_wait
+    void flush_updates();
+
+    [[nodiscard]] uint64_t epoll_ctl_calls() const { return m_epoll_ctl_calls.load(std::memory_order_relaxed); }
 
 private:
-    void apply_ops(int operation, Channel *channel) const;
+    void add_channel(Channel *channel);
+
+    void apply_ops(int operation, Channel *channel);
+
+    void drop_pending_update(Channel *channel);
 };
 
 #endif // TKS_EVENT_MANAGER
@@ -0,0 +1,97 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_LATENCY_HISTOGRAM)
+#define TKS_LATENCY_HISTOGRAM
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+#include "fastlog/not_copyable.hpp"
+
+#define LATENCY_BUCKETS 48
+
+// horloge des mesures de latence, en ns
+inline int64_t latency_clock_ns(clockid_t clock = CLOCK_MONOTONIC)
+{
+    timespec ts{};
+    clock_gettime(clock, &ts);
+    return (int64_t) ts.tv_sec * 1'000'000'000 + ts.tv_nsec;
+}
+
+// Histogramme à buckets en puissances de 2 : le bucket i compte les durées dans [2^i, 2^(i+1)) ns.
+// Un seul écrivain (le thread de la boucle), lecture depuis n'importe quel thread.
+class LatencyHistogram : notcopyable
+{
+private:
+    std::atomic<uint64_t> m_buckets[LATENCY_BUCKETS]{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum_ns{0};
+
+    static void bump(std::atomic<uint64_t> &counter, uint64_t n)
+    {
+        // écrivain unique : pas besoin d'un fetch_add verrouillé
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+public:
+    void record(int64_t ns)
+    {
+        const uint64_t value = ns > 0 ? (uint64_t) ns : 1;
+        int bucket = 63 - __builtin_clzll(value);
+        if (bucket >= LATENCY_BUCKETS)
+        {
+            bucket = LATENCY_BUCKETS - 1;
+        }
+        bump(m_buckets[bucket], 1);
+        bump(m_count, 1);
+        bump(m_sum_ns, value);
+    }
+
+    [[nodiscard]] uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+
+    [[nodiscard]] uint64_t mean_ns() const
+    {
+        const uint64_t n = count();
+        return n == 0 ? 0 : m_sum_ns.load(std::memory_order_relaxed) / n;
+    }
+
+    // borne haute du bucket contenant le percentile p (0 < p <= 1), 0 si vide
+    [[nodiscard]] uint64_t percentile_ns(double p) const
+    {
+        const uint64_t n = count();
+        if (n == 0)
+        {
+            return 0;
+        }
+        const auto rank = (uint64_t) (p * (double) n + 0.5);
+        uint64_t seen = 0;
+        for (int i = 0; i < LATENCY_BUCKETS; ++i)
+        {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank && seen > 0)
+            {
+                return (uint64_t) 2 << i;
+            }
+        }
+        return (uint64_t) 2 << (LATENCY_BUCKETS - 1);
+    }
+
+    [[nodiscard]] uint64_t bucket(int i) const { return m_buckets[i].load(std::memory_order_relaxed); }
+};
+
+// Étapes mesurées pour les connexions dont le traçage est activé (TcpConnection::enable_latency_tracing)
+struct LatencyStats
+{
+    LatencyHistogram kernel;   // horodatage logiciel RX du noyau -> retour de recv (SO_TIMESTAMPING)
+    LatencyHistogram loop;     // retour d'epoll_wait -> retour de recv
+    LatencyHistogram handler;  // durée du data callback
+    LatencyHistogram queue;    // write_buffer / write_shared sur une sortie vide -> dernier octet accepté par send
+    LatencyHistogram total;    // retour de recv -> sortie vidée, pour la réponse qui suit une lecture
+};
+
+#endif // TKS_LATENCY_HISTOGRAM
@@ -0,0 +1,37 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_LISTENER_PROFILE)
+#define TKS_LISTENER_PROFILE
+
+#include <cstdint>
+
+// Réglages TCP d'un listener et des connexions qu'il accepte. Ignorés pour AF_UNIX.
+// Les valeurs par défaut reproduisent le comportement historique (TCP_NODELAY seul).
+struct ListenerProfile
+{
+    // Socket d'écoute
+    int fastopen_queue{0};        // TCP_FASTOPEN : taille de la file des SYN avec données, 0 : désactivé
+    int defer_accept_sec{0};      // TCP_DEFER_ACCEPT : accept4 ne réveille qu'à l'arrivée des premiers octets, 0 : désactivé
+
+    // Chaque connexion acceptée
+    bool nodelay{true};           // TCP_NODELAY
+    bool quickack{false};         // TCP_QUICKACK, posé à l'accept ; le noyau peut le réinitialiser ensuite
+    int rcvlowat{0};              // SO_RCVLOWAT en octets, 0 : valeur du noyau (1)
+
+    // Clients courts requête/réponse : la requête arrive avec le SYN ou réveille directement l'accept.
+    // Côté client TFO nécessite net.ipv4.tcp_fastopen & 1, côté serveur & 2.
+    static ListenerProfile request_response()
+    {
+        ListenerProfile profile;
+        profile.fastopen_queue = 4096;
+        profile.defer_accept_sec = 5;
+        profile.quickack = true;
+        return profile;
+    }
+};
+
+#endif // TKS_LISTENER_PROFILE
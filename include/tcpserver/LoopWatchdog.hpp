@@ -0,0 +1,84 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_LOOP_WATCHDOG)
+#define TKS_LOOP_WATCHDOG
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fastlog/not_copyable.hpp"
+
+#define WATCHDOG_MAX_FRAMES 64
+
+class EventLoop;
+
+struct StallReport
+{
+    EventLoop *loop;
+    int64_t stalled_ms;  // durée de l'itération bloquée au moment du constat
+    int activity;        // fd du Channel en cours, ou phase EventLoop::kActivity*
+    int depth;           // nombre de frames capturées, 0 si la pile n'a pas pu être lue
+    void *frames[WATCHDOG_MAX_FRAMES];
+};
+
+// Thread de surveillance des boucles : une itération qui dépasse budget_ms est signalée une fois, avec la pile
+// du thread bloqué (capturée par un signal envoyé à ce thread) et le fd ou la phase en cours.
+// Coût côté boucle : les stores relaxed de EventLoop (heartbeat, début d'itération, activité).
+// La pile est lue par backtrace() dans le handler du signal, ce qui suppose libgcc déjà chargé (start() s'en charge) :
+// une boucle interrompue dans le chargeur dynamique peut ne pas donner de pile (depth == 0).
+class LoopWatchdog : notcopyable
+{
+private:
+    struct Watched
+    {
+        EventLoop *loop;
+        uint64_t reported_heartbeat; // itération déjà signalée
+    };
+
+    const uint32_t m_budget_ms;
+    const int m_signal;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<Watched> m_loops;
+    std::function<void(StallReport const &)> m_on_stall;
+    std::thread m_thread;
+    bool m_running{false};
+    std::atomic<uint64_t> m_stalls{0};
+
+    void run();
+
+    bool capture(EventLoop *loop, StallReport *report) const;
+
+    static void default_report(StallReport const &report);
+
+public:
+    // signal : utilisé pour interrompre le thread bloqué, il ne doit pas servir ailleurs dans le processus
+    explicit LoopWatchdog(uint32_t budget_ms, int signal = -1);
+
+    ~LoopWatchdog();
+
+    // depuis n'importe quel thread, avant ou après start()
+    void watch(EventLoop *loop);
+
+    void unwatch(EventLoop *loop);
+
+    // appelé dans le thread du watchdog ; par défaut : log et pile symbolisée sur stderr
+    void set_on_stall(std::function<void(StallReport const &)> const &cb);
+
+    void start();
+
+    void stop();
+
+    [[nodiscard]] uint64_t stalls() const { return m_stalls.load(std::memory_order_relaxed); }
+};
+
+#endif // TKS_LOOP_WATCHDOG
@@ -0,0 +1,85 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_MIRRORED_RING)
+#define TKS_MIRRORED_RING
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "fastlog/not_copyable.hpp"
+
+#define RING_SIZE_CLASS_MIN (64 * 1024)
+#define RING_SIZE_CLASSES 6 // 64 Ko .. 2 Mo
+#define RING_POOL_PER_CLASS 8
+
+// Ring d'octets dont la mémoire (un memfd) est projetée deux fois de suite : data()[0 .. readable()) et
+// write_ptr()[0 .. writable()) sont toujours contigus, quelle que soit la position de la tête.
+// Un parseur voit une trame entière sans memmove ni gestion du retour au début.
+// Un seul thread à la fois, pas de synchronisation.
+class MirroredRing : notcopyable
+{
+private:
+    uint8_t *m_base;
+    const uint32_t m_capacity; // puissance de deux, multiple de la taille de page
+    uint64_t m_head{0};        // octets consommés depuis la création
+    uint64_t m_tail{0};        // octets produits depuis la création
+
+public:
+    // capacity est arrondie à la puissance de deux supérieure (au moins une page). Lève std::system_error, EINVAL
+    // au-delà de 2^31.
+    explicit MirroredRing(uint32_t capacity);
+
+    ~MirroredRing();
+
+    [[nodiscard]] uint32_t capacity() const { return m_capacity; }
+
+    [[nodiscard]] uint32_t readable() const { return (uint32_t) (m_tail - m_head); }
+
+    [[nodiscard]] uint32_t writable() const { return m_capacity - readable(); }
+
+    [[nodiscard]] bool empty() const { return m_head == m_tail; }
+
+    [[nodiscard]] const uint8_t *data() const { return m_base + (m_head & (m_capacity - 1)); }
+
+    [[nodiscard]] uint8_t *write_ptr() { return m_base + (m_tail & (m_capacity - 1)); }
+
+    // après une écriture directe (recv, readv) dans write_ptr()
+    void produce(uint32_t count) { m_tail += count; }
+
+    void consume(uint32_t count) { m_head += count; }
+
+    void clear() { m_head = m_tail = 0; }
+};
+
+// Rings libérés par les connexions d'une boucle, rangés par classe de taille : les mmap/memfd ne sont payés
+// qu'à la création, pas à chaque connexion. Thread de la boucle propriétaire.
+class RingPool : notcopyable
+{
+private:
+    std::vector<std::unique_ptr<MirroredRing>> m_free[RING_SIZE_CLASSES];
+    uint64_t m_created{0};
+    uint64_t m_reused{0};
+
+    static int size_class(uint32_t capacity);
+
+public:
+    RingPool() = default;
+
+    // ring vide d'au moins min_capacity octets, réutilisé si possible
+    std::unique_ptr<MirroredRing> acquire(uint32_t min_capacity);
+
+    // garde au plus RING_POOL_PER_CLASS rings par classe, les autres sont démappés
+    void release(std::unique_ptr<MirroredRing> ring);
+
+    [[nodiscard]] uint64_t created() const { return m_created; }
+
+    [[nodiscard]] uint64_t reused() const { return m_reused; }
+};
+
+#endif // TKS_MIRRORED_RING
@@ -0,0 +1,54 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_PEER_ADDRESS)
+#define TKS_PEER_ADDRESS
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// Adresse brute du pair d'une connexion, formatée seulement à la demande.
+// AF_INET et AF_INET6 sont conservés tels quels (28 octets au lieu des 128 d'un sockaddr_storage) ;
+// pour AF_UNIX seule la famille est gardée, le pair étant généralement anonyme.
+class PeerAddress
+{
+private:
+    union {
+        sockaddr sa;
+        sockaddr_in in4;
+        sockaddr_in6 in6;
+    } m_addr{};
+
+public:
+    // taille suffisante pour format() : "[" ip6 "]:" port
+    static constexpr size_t kMaxFormatted = INET6_ADDRSTRLEN + 8;
+
+    PeerAddress() { m_addr.sa.sa_family = AF_UNSPEC; }
+
+    PeerAddress(const sockaddr *addr, socklen_t addr_len);
+
+    [[nodiscard]] int family() const { return m_addr.sa.sa_family; }
+
+    [[nodiscard]] uint16_t port() const;
+
+    [[nodiscard]] const sockaddr *address() const { return &m_addr.sa; }
+
+    // Écrit l'ip seule dans buf ("unix" pour AF_UNIX), retourne la longueur écrite (0 si buf est trop petit)
+    size_t format_ip(char *buf, size_t len) const;
+
+    // Écrit "ip:port" ("[ip]:port" en IPv6) dans buf, retourne la longueur écrite (0 si buf est trop petit)
+    size_t format(char *buf, size_t len) const;
+
+    // alloue : réservé aux chemins froids
+    [[nodiscard]] std::string ip() const;
+
+    [[nodiscard]] std::string to_string() const;
+};
+
+#endif // TKS_PEER_ADDRESS
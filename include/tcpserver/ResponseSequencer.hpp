@@ -0,0 +1,89 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_RESPONSE_SEQUENCER)
+#define TKS_RESPONSE_SEQUENCER
+
+#include <cstdint>
+#include <deque>
+
+#include "fastlog/not_copyable.hpp"
+
+class ProtoBuffer;
+
+// Remet dans l'ordre des requêtes les réponses d'une connexion pipelinée traitées en parallèle.
+// Chaque requête réserve un slot à sa lecture ; les réponses complétées dans le désordre attendent ici que
+// tous les slots précédents le soient, puis partent ensemble. Utilisé par TcpConnection, dans le thread de la boucle.
+class ResponseSequencer : notcopyable
+{
+private:
+    struct Slot
+    {
+        ProtoBuffer *response; // nullptr : requête sans réponse
+        bool done;
+    };
+
+    const uint32_t m_max_in_flight;
+    uint64_t m_next_slot{0};
+    uint64_t m_next_flush{0};   // premier slot non envoyé, m_slots[0]
+    std::deque<Slot> m_slots;
+
+    uint64_t m_flushed{0};
+    uint64_t m_batches{0};
+
+public:
+    explicit ResponseSequencer(uint32_t max_in_flight) : m_max_in_flight(max_in_flight == 0 ? 1 : max_in_flight) {}
+
+    // rend les réponses jamais envoyées
+    ~ResponseSequencer();
+
+    [[nodiscard]] uint64_t reserve()
+    {
+        m_slots.push_back(Slot{nullptr, false});
+        return m_next_slot++;
+    }
+
+    // Au-delà de max_in_flight réservations non envoyées, la connexion cesse de lire. Une lecture déjà en cours
+    // peut réserver quelques slots de plus : la borne ne coupe pas une trame reçue en plein milieu.
+    [[nodiscard]] bool full() const { return m_slots.size() >= m_max_in_flight; }
+
+    [[nodiscard]] uint32_t in_flight() const { return (uint32_t) m_slots.size(); }
+
+    [[nodiscard]] uint32_t max_in_flight() const { return m_max_in_flight; }
+
+    // false si slot n'est pas réservé ou déjà complété : response n'est alors pas prise en charge
+    bool complete(uint64_t slot, ProtoBuffer *response);
+
+    // Passe à emit, dans l'ordre, les réponses des slots complétés contigus en tête. Retourne le nombre de slots libérés.
+    template<typename Emit>
+    uint32_t drain(Emit &&emit)
+    {
+        uint32_t count = 0;
+        while (!m_slots.empty() && m_slots.front().done)
+        {
+            if (m_slots.front().response != nullptr)
+            {
+                emit(m_slots.front().response);
+            }
+            m_slots.pop_front();
+            ++m_next_flush;
+            ++count;
+        }
+        if (count > 0)
+        {
+            m_flushed += count;
+            ++m_batches;
+        }
+        return count;
+    }
+
+    // réponses envoyées et nombre de lots : flushed / batches donne la taille moyenne d'un lot
+    [[nodiscard]] uint64_t flushed() const { return m_flushed; }
+
+    [[nodiscard]] uint64_t batches() const { return m_batches; }
+};
+
+#endif // TKS_RESPONSE_SEQUENCER
@@ -0,0 +1,38 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_SHARED_PAYLOAD)
+#define TKS_SHARED_PAYLOAD
+
+#include <cstdint>
+#include <memory>
+
+#include "fastlog/not_copyable.hpp"
+
+class ProtoBuffer;
+
+// Bloc d'octets immuable partagé par référence entre plusieurs connexions (et plusieurs boucles).
+// Le compteur de références du shared_ptr est le seul état modifié après la création.
+class SharedPayload : notcopyable
+{
+private:
+    std::unique_ptr<uint8_t[]> m_bytes;
+    uint32_t m_size;
+
+public:
+    SharedPayload(const uint8_t *data, uint32_t size);
+
+    // copie les octets restants (position -> limit) de buffer, buffer n'est pas modifié
+    static std::shared_ptr<const SharedPayload> create(ProtoBuffer *buffer);
+
+    static std::shared_ptr<const SharedPayload> create(const uint8_t *data, uint32_t size);
+
+    [[nodiscard]] const uint8_t *bytes() const { return m_bytes.get(); }
+
+    [[nodiscard]] uint32_t size() const { return m_size; }
+};
+
+#endif // TKS_SHARED_PAYLOAD
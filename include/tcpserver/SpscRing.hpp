@@ -0,0 +1,108 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_SPSC_RING)
+#define TKS_SPSC_RING
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "fastlog/not_copyable.hpp"
+
+#define TKS_CACHE_LINE 64
+
+// File bornée un producteur / un consommateur, sans verrou.
+// Les index du producteur et du consommateur sont sur des lignes de cache séparées,
+// et chacun garde une copie locale de l'index de l'autre pour ne relire l'atomique que si nécessaire.
+template<typename T>
+class SpscRing : notcopyable
+{
+private:
+    alignas(TKS_CACHE_LINE) std::atomic<uint64_t> m_head{0}; // écrit par le consommateur
+    uint64_t m_cached_tail{0};
+
+    alignas(TKS_CACHE_LINE) std::atomic<uint64_t> m_tail{0}; // écrit par le producteur
+    uint64_t m_cached_head{0};
+
+    alignas(TKS_CACHE_LINE) const uint64_t m_mask;
+    std::unique_ptr<T[]> m_slots;
+
+    static uint64_t round_up(uint32_t capacity)
+    {
+        uint64_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        return size;
+    }
+
+public:
+    // capacity est arrondie à la puissance de deux supérieure
+    explicit SpscRing(uint32_t capacity) : m_mask(round_up(capacity) - 1), m_slots(new T[m_mask + 1]) {}
+
+    [[nodiscard]] uint64_t capacity() const { return m_mask + 1; }
+
+    // producteur uniquement. Retourne false si la file est pleine
+    bool push(T &&item)
+    {
+        const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cached_head > m_mask)
+        {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if (tail - m_cached_head > m_mask)
+            {
+                return false;
+            }
+        }
+        m_slots[tail & m_mask] = std::move(item);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consommateur uniquement. Appelle fn sur au plus max éléments, retourne le nombre consommé
+    template<typename F>
+    uint64_t drain(F &&fn, uint64_t max)
+    {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cached_tail)
+        {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cached_tail)
+            {
+                return 0;
+            }
+        }
+
+        const uint64_t end = m_cached_tail - head > max ? head + max : m_cached_tail;
+        const uint64_t count = end - head;
+        for (; head != end; ++head)
+        {
+            T item = std::move(m_slots[head & m_mask]);
+            m_slots[head & m_mask] = T();
+            // le slot est libéré avant l'appel : fn peut elle-même produire dans une autre file
+            m_head.store(head + 1, std::memory_order_release);
+            fn(item);
+        }
+        return count;
+    }
+
+    // consommateur uniquement
+    [[nodiscard]] bool empty()
+    {
+        const uint64_t head = m_head.load(std::memory_order_relaxed);
+        if (head != m_cached_tail)
+        {
+            return false;
+        }
+        m_cached_tail = m_tail.load(std::memory_order_acquire);
+        return head == m_cached_tail;
+    }
+};
+
+#endif // TKS_SPSC_RING
@@ -0,0 +1,77 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_TCP_CLIENT)
+#define TKS_TCP_CLIENT
+
+#include <memory>
+#include <functional>
+#include <string>
+#include <mutex>
+
+#include "fastlog/not_copyable.hpp"
+
+class EventLoop;
+class Connector;
+class TcpConnection;
+class ProtoBuffer;
+
+// Client TCP (ou Unix) non bloquant attaché à une EventLoop. Le Connector établit la connexion,
+// puis le fd est confié à une TcpConnection ordinaire : même chemin d'E/S que côté serveur.
+// Le TcpClient doit être détruit dans le thread de sa boucle.
+class TcpClient : notcopyable
+{
+private:
+    EventLoop *m_loop;
+    std::string m_name;
+    std::unique_ptr<Connector> m_connector;
+    bool m_retry{false};
+    bool m_connect{false};
+
+    mutable std::mutex m_mutex;
+    std::shared_ptr<TcpConnection> m_connection;
+
+    std::function<void(const std::shared_ptr<TcpConnection> &, ProtoBuffer *buf, int64_t time)> m_data_received_cb;
+    std::function<void(std::shared_ptr<TcpConnection> const &)> m_write_complete_cb;
+    std::function<void(const std::shared_ptr<TcpConnection> &)> m_connection_state_change_cb;
+
+    void on_new_connection(int sock_fd);
+
+    void remove_connection_internal(std::shared_ptr<TcpConnection> const &conn);
+
+public:
+    // ip littérale IPv4 ou IPv6, lève std::system_error si elle est invalide
+    TcpClient(EventLoop *loop, const std::string &ip, uint16_t port, std::string name);
+
+    // socket Unix, '@' en tête pour l'espace de noms abstrait
+    TcpClient(EventLoop *loop, const std::string &unix_path, std::string name);
+
+    ~TcpClient();
+
+    void connect();
+
+    // ferme la connexion établie (s'il y en a une) et arrête les tentatives
+    void disconnect();
+
+    // reconnexion automatique après la perte de la connexion
+    void enable_retry(bool retry) { m_retry = retry; }
+
+    void set_retry_delay(uint32_t init_ms, uint32_t max_ms);
+
+    [[nodiscard]] std::shared_ptr<TcpConnection> connection() const;
+
+    [[nodiscard]] EventLoop *event_loop() const { return m_loop; }
+
+    [[nodiscard]] const std::string &name() const { return m_name; }
+
+    void set_on_data_received(std::function<void(const std::shared_ptr<TcpConnection> &, ProtoBuffer *buf, int64_t time)> const &cb) { m_data_received_cb = cb; }
+
+    void set_on_write_complete(std::function<void(std::shared_ptr<TcpConnection> const &)> const &cb) { m_write_complete_cb = cb; }
+
+    void set_on_connection_state_change(std::function<void(std::shared_ptr<TcpConnection> const &)> const &cb) { m_connection_state_change_cb = cb; }
+};
+
+#endif // TKS_TCP_CLIENT
@@ -7,52 +7,221 @@
 
 #include "fastlog/not_copyable.hpp"
 #include "TcpConnContext.hpp"
+#include "PeerAddress.hpp"
+#include <atomic>
 #include <memory>
 #include <string>
 #include <functional>
+#include <string_view>
 #include "EventLoop.hpp"
+#include "Channel.hpp"
 
 class ProtoBuffer;
 
+class SharedPayload;
+
+class ReadAwaiter;
+
+class WriteAwaiter;
+
+class SleepAwaiter;
+
+struct CoroutineState;
+
 class ByteStream;
 
+class ResponseSequencer;
+
+class MirroredRing;
+
+class TlsContext;
+
+struct TlsState;
+
 class EventLoop;
 
-class Channel;
+class TcpConnection;
+
+// Données reçues dans la ring d'entrée (voir TcpConnection::enable_input_ring) : data couvre tous les octets non
+// consommés, contigus. Retourne le nombre d'octets consommés, le reste est présenté à nouveau avec les suivants.
+using RingDataCallback = std::function<uint32_t(std::shared_ptr<TcpConnection> const &, const uint8_t *data,
+                                                uint32_t length, int64_t time)>;
+
+// Callbacks d'une connexion. Une seule table est partagée par toutes les connexions d'un Acceptor ou d'un TcpClient,
+// au lieu de quatre std::function copiées dans chaque connexion.
+struct ConnectionCallbacks {
+    std::function<void(std::shared_ptr<TcpConnection> const &)> state_change;
+    std::function<void(std::shared_ptr<TcpConnection> const &)> write_complete;
+    std::function<void(std::shared_ptr<TcpConnection> const &)> closed;
+    std::function<void(std::shared_ptr<TcpConnection> const &, ProtoBuffer *buf, int64_t time)> data_received;
+    // SO_RCVLOWAT posé à l'accept (ListenerProfile::rcvlowat), rétabli après un await_frame_bytes() ; ici plutôt que
+    // dans chaque connexion, la table étant partagée par toutes celles de l'Acceptor
+    int rcvlowat{1};
+
+    // les callbacks non définis deviennent des no-op : une connexion les appelle sans tester
+    void fill_noop();
+};
 
-class TcpConnection : notcopyable, public std::enable_shared_from_this<TcpConnection> {
+class TcpConnection : notcopyable, public std::enable_shared_from_this<TcpConnection>, private ChannelHandler {
 private:
-    enum StateE {
+    enum StateE : uint8_t {
         kConnecting,
         kConnected,
         kDisconnecting,
         kDisconnected,
     };
 
-    EventLoop *m_loop;
-    int m_fd;
-    std::string m_ip;
-    uint16_t m_port;
-    int m_family;
-    long m_conn_id;
+    // payloads partagés (broadcast) en attente, intercalés dans le ByteStream par leur offset d'écriture
+    struct SharedSegment {
+        std::shared_ptr<const SharedPayload> payload;
+        uint64_t stream_offset; // octets ajoutés au ByteStream avant ce payload
+        uint32_t sent;
+    };
 
-    std::unique_ptr<Channel> m_channel;
+    // file des SharedSegment, qui compte ses allocations (voir trim_idle())
+    struct SharedQueue;
 
-    std::unique_ptr<ByteStream> m_outgoing_byte_stream;
-    StateE m_state{kConnecting};
+    // mode bridge : les octets reçus sur ce socket passent par pipe_fds avant d'être splicés vers le pair
+    struct BridgeState;
+
+    // horodatages du traçage de latence, voir enable_latency_tracing()
+    struct LatencyTrace;
+
+    // ring d'entrée et son callback, voir enable_input_ring()
+    struct RingInput;
 
-    // in sec
-    time_t m_timeout{15};
+    // Une connexion inactive ne doit coûter que cet objet (et son bloc make_shared) : tout ce qui ne sert qu'à
+    // certaines connexions est alloué à la demande. Les champs lus à chaque événement sont en tête.
+    EventLoop *m_loop;
+    StateE m_state{kConnecting};
+    uint8_t m_read_shrink_streak{0};
+    bool m_shutdown_started : 1 {false};
+    bool m_read_resume_queued : 1 {false}; // budget de lecture épuisé, lecture reprise à l'itération suivante
+    bool m_sticky_out : 1 {false};         // EPOLLOUT enregistré en permanence (EventLoop::set_sticky_write_interest)
+    bool m_write_blocked : 1 {false};      // EAGAIN à l'envoi, EPOLLOUT viendra
+    bool m_flush_queued : 1 {false};
+    bool m_lowat_raised : 1 {false};       // SO_RCVLOWAT > 1 posé par await_frame_bytes()
+    bool m_lowat_requested : 1 {false};    // ... pendant le callback en cours
+    uint8_t m_read_paused{0};              // kPause* : qui a suspendu la lecture
+    // taille de la prochaine lecture, ajustée selon les lectures récentes (voir adapt_read_size)
+    uint32_t m_read_size;
     int64_t m_last_event_time{0};
+    std::shared_ptr<const ConnectionCallbacks> m_callbacks;
+    Channel m_channel;
+
+    // alloué à la première écriture
+    std::unique_ptr<ByteStream> m_outgoing_byte_stream;
+    uint64_t m_stream_appended{0};
+    uint64_t m_stream_sent{0};
+
+    long m_conn_id;
+    PeerAddress m_peer; // formatée à la demande, pas de std::string par connexion
+    // in sec, 0 = kNoTimeout ; dans le bourrage après m_peer
+    uint16_t m_timeout{15};
+    // kInTransit pendant une migration, plus le nombre d'appels run_in_loop en train de poster (voir run_in_loop)
+    std::atomic<uint16_t> m_transit{0};
     int64_t m_shutdown_time{0};
-    bool m_shutdown_started{false};
+    int64_t m_last_write_time{0};
 
+    // alloués à la demande
+    std::unique_ptr<SharedQueue> m_shared_out;
     std::unique_ptr<TcpConnContext> m_context{nullptr};
+    std::unique_ptr<BridgeState> m_bridge;
+    std::unique_ptr<LatencyTrace> m_latency;
+    std::unique_ptr<ResponseSequencer> m_sequencer;
+    std::unique_ptr<RingInput> m_ring;
+    // API coroutine (Coroutine.hpp), alloué à la première attente
+    std::unique_ptr<CoroutineState> m_co;
+    // connexion TLS (voir start_tls), nullptr en clair
+    std::unique_ptr<TlsState> m_tls;
+
+    CoroutineState *co_state();
+
+    void co_on_data(const uint8_t *data, uint32_t length);
+
+    void co_on_drained();
+
+    void co_on_slept();
+
+    void co_on_closed();
+
+    // suspend ou reprend la lecture selon ce que la coroutine a laissé dans m_co->input
+    void co_update_flow();
+
+    friend class ReadAwaiter;
+    friend class WriteAwaiter;
+    friend class SleepAwaiter;
+    friend class BroadcastGroup;
+
+    // ChannelHandler
+    void on_channel_read(int64_t receive_time) override
+    {
+        m_loop->count_read_wakeup();
+        handle_read(receive_time);
+    }
+
+    void on_channel_write() override
+    {
+        m_write_blocked = false;
+        handle_write();
+    }
+
+    void on_channel_close() override { handle_close(0); }
+
+    void on_channel_error() override { handle_error(0); }
+
+    void on_channel_periodic(int64_t now) override { on_periodic_notification(now); }
 
     void handle_read(int64_t receiveTime);
 
+    void adapt_read_size(uint32_t read_count);
+
+    void yield_read();
+
+    void ring_read(int64_t receive_time);
+
+    void release_ring();
+
+    // après le callback d'une lecture : false si la lecture doit s'arrêter en attendant le SO_RCVLOWAT demandé
+    bool after_frame_callback();
+
+    void reset_rcvlowat();
+
+    enum PauseReason : uint8_t {
+        kPauseUser = 1,
+        kPauseSequencer = 2,
+        kPauseCoroutine = 4,
+    };
+
+    static constexpr uint16_t kInTransit = 0x8000;
+
+    void pause_reading_internal(PauseReason reason);
+
+    void resume_reading_internal(PauseReason reason);
+
+    void complete_response_internal(uint64_t slot, ProtoBuffer *response);
+
+    ssize_t recv_timestamped(uint8_t *data, uint32_t length, int64_t *kernel_rx_ns);
+
+    void trace_enqueue();
+
+    void trace_drained();
+
+    [[nodiscard]] TcpConnection *bridge_peer() const;
+
+    void bridge_read();
+
+    void bridge_write();
+
+    bool bridge_open_pipe();
+
+    void bridge_close_pipe();
+
     void handle_write();
 
+    // données ajoutées à la file d'envoi : active EPOLLOUT, ou en mode permanent programme un envoi
+    void request_flush();
+
     void handle_close(int reason);
 
     void handle_error(int local_errno);
@@ -62,13 +231,50 @@ private:
 
     void on_periodic_notification(int64_t now);
 
-    void write_buffer_internal(ProtoBuffer *buffer) const;
+    void trim_idle(int64_t now);
+
+    void write_buffer_internal(ProtoBuffer *buffer);
+
+    void write_shared_internal(std::shared_ptr<const SharedPayload> const &payload);
+
+    // appelé depuis une boucle : vrai si la connexion lui appartient et ne migre pas, les *_internal sont utilisables
+    [[nodiscard]] bool owned_by_current_thread() const {
+        return (m_transit.load() & kInTransit) == 0 && m_loop->isInLoopThread();
+    }
+
+    ssize_t send_bytes(const uint8_t *data, uint32_t length);
 
-    std::function<void(std::shared_ptr<TcpConnection> const &)> m_connection_state_change_cb;
-    std::function<void(std::shared_ptr<TcpConnection> const &)> m_write_completed_cb;
-    std::function<void(std::shared_ptr<TcpConnection> const &)> m_connection_close_cb;
-    std::function<void(std::shared_ptr<TcpConnection> const &, ProtoBuffer *buf, int64_t time)> m_data_received_cb;
+    // recv() ou SSL_read() selon la connexion, mêmes conventions que recv() (EAGAIN, 0 à la fermeture)
+    ssize_t recv_bytes(uint8_t *data, uint32_t length);
 
+    // TLS, dans TlsContext.cpp
+    void tls_begin();
+
+    void tls_handshake();
+
+    ssize_t tls_recv(uint8_t *data, uint32_t length);
+
+    ssize_t tls_send(const uint8_t *data, uint32_t length);
+
+    void tls_close_notify() const;
+
+    // octets déchiffrés gardés par OpenSSL : aucun EPOLLIN ne les signalera
+    [[nodiscard]] bool tls_pending() const;
+
+    [[nodiscard]] bool tls_handshaking() const;
+
+    [[nodiscard]] bool has_pending_output() const;
+
+    // copie la table partagée avant de modifier un callback de cette seule connexion
+    ConnectionCallbacks &own_callbacks();
+
+    // migration, voir migrate_to() : retrait de la boucle source, puis inscription dans la boucle cible
+    void migrate_detach(EventLoop *target);
+
+    void migrate_attach();
+
+    // fin du transfert (ou abandon) : les appels retenus pendant celui-ci sont rejoués dans l'ordre
+    void migrate_release_backlog();
 public:
     std::string state_str() const
     {
@@ -76,33 +282,131 @@ public:
     }
 
 
-    TcpConnection(EventLoop *loop, int sock_fd, std::string ip, uint16_t port, int family, long conn_id);
+    TcpConnection(EventLoop *loop, int sock_fd, PeerAddress const &peer, long conn_id);
 
     ~TcpConnection();
 
+    // identifiant unique dans le processus, partagé par les connexions acceptées et sortantes
+    static long generate_id();
+
     void write_buffer(ProtoBuffer *buffer);
 
+    // met en file une référence sur payload, sans copie : le même payload peut être envoyé à beaucoup de connexions
+    void write_shared(std::shared_ptr<const SharedPayload> const &payload);
+
     void connection_established();
 
     void connection_destroyed();
 
     void graceful_shutdown();
 
+    // Relie cette connexion à other (même boucle obligatoire) : les données circulent dans les deux sens par splice(),
+    // sans copie en espace utilisateur ni passage par le data callback. La fermeture d'un côté ferme l'autre.
+    // À appeler dans le thread de la boucle. Retourne false si le bridge est impossible, notamment pour une connexion
+    // TLS dont le chiffrement n'est pas délégué au noyau dans les deux sens.
+    bool bridge(std::shared_ptr<TcpConnection> const &other);
+
+    [[nodiscard]] bool is_bridged() const { return bridge_peer() != nullptr; }
+
+    // Avant connection_established() : la connexion sera servie en TLS avec context. Le handshake est mené par la
+    // boucle et le callback "connecté" n'est appelé qu'après ; un échec ferme la connexion sans aucun callback.
+    void start_tls(std::shared_ptr<TlsContext> context);
+
+    [[nodiscard]] bool is_tls() const { return m_tls != nullptr; }
+
+    // handshake terminé et chiffrement de l'envoi (tx) / de la réception (rx) délégué au noyau
+    [[nodiscard]] bool is_ktls_tx() const;
+
+    [[nodiscard]] bool is_ktls_rx() const;
+
+    // Attentes pour les coroutines ConnTask (inclure Coroutine.hpp), à utiliser dans le thread de la boucle.
+    // Dès la première attente, les données reçues sont réservées à la coroutine et le data callback n'est plus appelé.
+    ReadAwaiter read_exactly(uint32_t n);
+
+    ReadAwaiter read_until(std::string_view delimiter);
+
+    WriteAwaiter write(ProtoBuffer *buffer);
+
+    SleepAwaiter sleep(uint32_t ms);
+
+    // Octets reçus et pas encore lus par la coroutine au-delà desquels la lecture du socket est suspendue, tant que
+    // la coroutine n'attend pas de données (1 MiB par défaut). Dans le thread de la boucle.
+    void set_co_input_high_water(size_t bytes);
+
+    // Suspend la lecture du socket : les données restent dans le noyau et le contrôle de flux TCP ralentit le client.
+    // Utilisable depuis n'importe quel thread.
+    void pause_reading();
+
+    void resume_reading();
+
+    [[nodiscard]] bool is_reading_paused() const { return m_read_paused != 0; }
+
+    // Réponses ordonnées pour une connexion pipelinée dont les requêtes sont traitées en parallèle (voir ResponseSequencer).
+    // Dans le thread de la boucle : enable_sequencing() une fois, puis reserve_response() pour chaque requête lue,
+    // dans l'ordre de réception. Au-delà de max_in_flight réponses en attente, la lecture est suspendue.
+    void enable_sequencing(uint32_t max_in_flight);
+
+    uint64_t reserve_response();
+
+    // Depuis n'importe quel thread : la réponse (nullptr si aucune) part quand les slots précédents sont complétés,
+    // avec toutes les réponses contiguës déjà prêtes.
+    void complete_response(uint64_t slot, ProtoBuffer *response);
+
+    // Dans le thread de la boucle : les lectures suivantes vont directement dans une ring projetée deux fois
+    // (MirroredRing, prise dans le pool de la boucle) et on_data remplace le data callback. Une trame incomplète
+    // reste dans la ring sans copie. Une ring pleine que on_data ne consomme pas ferme la connexion (EMSGSIZE).
+    // Retourne false si la ring ne peut pas être créée.
+    bool enable_input_ring(uint32_t min_capacity, RingDataCallback on_data);
+
+    // Dans le data callback (ou on_data de la ring) : la trame en cours attend encore missing octets, d'après son
+    // en-tête. SO_RCVLOWAT est posé à cette valeur (plafonnée à RCVLOWAT_MAX) et la lecture s'arrête : le noyau ne
+    // réveille la boucle qu'une fois la trame complète, au lieu d'un EPOLLIN par segment. Sans nouvel appel lors du
+    // callback suivant, le seuil revient à 1. Une fermeture du pair réveille toujours.
+    void await_frame_bytes(uint32_t missing);
+
+    // À appeler dans le thread de la boucle : mesure le chemin de chaque message de cette connexion (voir LatencyStats)
+    // dans les histogrammes de la boucle. kernel_timestamps active en plus SO_TIMESTAMPING (RX logiciel) pour isoler
+    // le temps passé dans le noyau ; retourne false si le noyau le refuse, le reste du traçage restant actif.
+    bool enable_latency_tracing(bool kernel_timestamps = false);
+
+    // Dans le thread de la boucle : déplace la connexion vers target, par exemple pour soulager une boucle chargée
+    // (voir TcpServer::enable_balancer). Le canal quitte la boucle actuelle à la fin de l'itération et rejoint
+    // target ; la file d'envoi, les réponses ordonnées, la ring et les callbacks suivent. Les appels faits entre-temps
+    // depuis d'autres threads (write_buffer, complete_response...) sont retenus puis rejoués dans l'ordre sur target,
+    // et les données arrivées pendant le transfert sont signalées par la nouvelle boucle.
+    // Retourne false si la connexion ne peut pas migrer : non connectée, en bridge, servie par une coroutine, en
+    // handshake TLS, ou déjà en transfert. L'Acceptor d'origine garde la connexion dans ses comptes et un
+    // BroadcastGroup la publie toujours depuis la boucle où elle l'a rejoint.
+    bool migrate_to(EventLoop *target);
+
+    // Depuis n'importe quel thread : exécute fn dans la boucle de la connexion, tout de suite si on y est déjà.
+    // Suit une migration en cours, contrairement à event_loop()->run().
+    void run_in_loop(std::function<void()> fn);
+
     void brute_close()
     {
         auto self = shared_from_this();
-        m_loop-> run([self]{self->handle_close(-1);});
+        run_in_loop([self]{self->handle_close(-1);});
     }
 
     inline long conn_id() const { return m_conn_id; }
 
-    inline EventLoop *event_loop() { return m_loop; }
+    // boucle actuelle de la connexion, qui change avec migrate_to()
+    inline EventLoop *event_loop() { return std::atomic_ref<EventLoop *>(m_loop).load(std::memory_order_acquire); }
 
-    inline std::string ip_addr() const { return m_ip; }
+    [[nodiscard]] const PeerAddress &peer() const { return m_peer; }
 
-    inline uint16_t port() const{ return m_port;}
+    // formate l'ip à chaque appel : préférer peer().format() avec un buffer de la pile sur les chemins chauds
+    inline std::string ip_addr() const { return m_peer.ip(); }
 
-    void set_timeout(time_t timeout); // in sec
+    inline uint16_t port() const { return m_peer.port(); }
+
+    [[nodiscard]] int family() const { return m_peer.family(); }
+
+    // pas de fermeture pour inactivité
+    static constexpr time_t kNoTimeout = 0;
+    // in sec, de 1 à UINT16_MAX (~18 h) ou kNoTimeout ; std::system_error (EINVAL) au-delà
+    void set_timeout(time_t timeout);
     bool is_connected() const;
 
     inline void set_context(TcpConnContext *ctx) {
@@ -119,17 +423,20 @@ public:
     // }
     TcpConnContext *get_mutable_context() { return m_context == nullptr ? nullptr : m_context.get(); }
 
+    // table partagée avec les autres connexions du même Acceptor / TcpClient
+    void set_callbacks(std::shared_ptr<const ConnectionCallbacks> callbacks) { m_callbacks = std::move(callbacks); }
+
     void set_on_connection_state_change(
-            std::function<void(std::shared_ptr<TcpConnection> const &)> const &osc) { m_connection_state_change_cb = osc; }
+            std::function<void(std::shared_ptr<TcpConnection> const &)> const &osc) { own_callbacks().state_change = osc; }
 
     void set_on_write_complete(
-            std::function<void(std::shared_ptr<TcpConnection> const &)> const &owc) { m_write_completed_cb = owc; }
+            std::function<void(std::shared_ptr<TcpConnection> const &)> const &owc) { own_callbacks().write_complete = owc; }
 
     void set_on_connection_closed(
-            std::function<void(std::shared_ptr<TcpConnection> const &)> const &occ) { m_connection_close_cb = occ; }
+            std::function<void(std::shared_ptr<TcpConnection> const &)> const &occ) { own_callbacks().closed = occ; }
 
     void set_on_data_received(std::function<void(std::shared_ptr<TcpConnection> const &, ProtoBuffer *buf,
-                                                 int64_t time)> const &odd) { m_data_received_cb = odd; }
+                                                 int64_t time)> const &odd) { own_callbacks().data_received = odd; }
 protected:
     void check_timeout(uint64_t now);
 };
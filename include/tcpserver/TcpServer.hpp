@@ -6,17 +6,25 @@
 #define TCP_SERVER
 
 #include "fastlog/not_copyable.hpp"
+#include "AdmissionControl.hpp"
+#include "ListenerProfile.hpp"
 
+#include <atomic>
 #include <string>
 #include <memory>
 #include <functional>
 #include <thread>
+#include <vector>
 
 class Acceptor;
+class LoopWatchdog;
 class EventLoop;
 class EventLoopThreadPool;
 class TcpConnection;
 class ProtoBuffer;
+class Channel;
+class TlsContext;
+class Timer;
 
 // La classe TcpServer est principalement utilisée pour l'établissement, la maintenance et la destruction des connexions Tcp
 // Il gère la classe Acceptor pour obtenir la connexion tcp, puis établit la classe TcpConnection pour gérer la connexion tcp
@@ -32,8 +40,66 @@ private:
     int32_t m_server_id;
     int32_t m_snd_buff;
     int32_t m_rcv_buff;
+    std::string m_unix_path; // non vide : écoute sur un socket AF_UNIX au lieu de TCP
+
+    // admission : doit être détruit après les Acceptors qui y font référence
+    size_t m_max_connections{0};
+    size_t m_max_connections_per_loop{0};
+    uint32_t m_accept_budget{64};
+    std::unique_ptr<AdmissionControl> m_admission;
+    ListenerProfile m_profile;
+    std::shared_ptr<TlsContext> m_tls;
+    int64_t m_idle_trim_sec{-1}; // -1 : valeur par défaut des boucles
+    bool m_read_budget_set{false};
+    uint32_t m_read_budget_bytes{0};
+    uint32_t m_read_budget_calls{0};
+    bool m_sticky_write_interest{false};
+    uint32_t m_watchdog_budget_ms{0};
+    std::unique_ptr<LoopWatchdog> m_watchdog; // détruit avant le pool de threads
+    // rééquilibrage des connexions entre boucles, voir enable_balancer()
+    uint32_t m_balance_period_ms{0};
+    double m_balance_high_ratio{0.75};
+    uint32_t m_balance_max_moves{1};
+    std::unique_ptr<Timer> m_balance_timer;
+    std::vector<uint64_t> m_balance_busy_ns; // EventLoop::busy_ns() de chaque boucle au tick précédent
+    int64_t m_balance_time_ns{0};
+    std::atomic<uint64_t> m_migrations{0};
     std::vector<std::unique_ptr<Acceptor>> m_acceptors;
 
+    // redémarrage sans coupure : sockets d'écoute reçus du processus précédent / transmis au suivant
+    std::vector<int> m_adopted_fds;
+    int m_handoff_listen_fd{-1};
+    std::string m_handoff_path;
+    std::unique_ptr<Channel> m_handoff_channel;
+    // échange en cours, non bloquant : vers le successeur (processus en place) ou le prédécesseur (nouveau processus)
+    int m_handoff_peer_fd{-1};
+    std::unique_ptr<Channel> m_handoff_peer_channel;
+    std::unique_ptr<Timer> m_handoff_timer;
+    size_t m_handoff_stopping{0}; // Acceptors qui n'ont pas encore arrêté d'écouter
+    bool m_handed_off{false};
+    std::function<void()> m_handoff_cb;
+
+    void handle_handoff();
+
+    void close_handoff_listener();
+
+    // processus en place : confirmation du successeur, puis réponse quand nos Acceptors n'acceptent plus
+    void handle_handoff_ack();
+
+    void handoff_released();
+
+    // nouveau processus : les Acceptors écoutent quand le prédécesseur a arrêté (ou ne répond plus)
+    void handle_handoff_release();
+
+    void listen_all();
+
+    void watch_handoff_peer(std::function<void()> const &on_readable, std::function<void()> const &on_timeout);
+
+    void close_handoff_peer();
+
+    // tick du rééquilibrage, dans la boucle principale
+    void balance();
+
     // cb
     std::function<void(const std::shared_ptr<TcpConnection> &)> m_connection_state_change_cb;
     std::function<void(const std::shared_ptr<TcpConnection> &, ProtoBuffer *buf, int64_t time)> m_data_received_cb;
@@ -41,6 +107,9 @@ private:
 
 public:
     TcpServer(EventLoop *loop, uint16_t listen_port, std::string name, int server_id, int32_t snd_buff, int32_t rcv_buff, uint32_t num_threads);
+
+    // Serveur local sur un socket Unix (IPC sur le même hôte). unix_path commençant par '@' : espace de noms abstrait
+    TcpServer(EventLoop *loop, std::string unix_path, std::string name, int server_id, uint32_t num_threads);
     ~TcpServer();
 
     // démarrer le serveur
@@ -48,10 +117,15 @@ public:
 
     [[nodiscard]] int listen_port() const;
 
+    [[nodiscard]] const std::string &unix_path() const { return m_unix_path; }
+
     [[nodiscard]] uint32_t pool_size() const;
 
     EventLoop *get_loop() { return m_loop; }
 
+    // boucles d'E/S du serveur (après start()), par exemple pour créer un UpstreamPool par boucle
+    [[nodiscard]] const std::vector<EventLoop *> &loops() const;
+
     void set_on_connection_state_change(std::function<void(std::shared_ptr<TcpConnection> const &)> const &cb) { m_connection_state_change_cb = cb; }
 
     void set_on_data_received(std::function<void(const std::shared_ptr<TcpConnection> &, ProtoBuffer *buf, int64_t time)> const &cb) { m_data_received_cb = cb; }
@@ -63,6 +137,78 @@ public:
     }
 
     [[nodiscard]] int32_t server_id() const;
+
+    // Nouveau processus, avant start() : récupère les sockets d'écoute du processus en place via le socket Unix
+    // handoff_path, au lieu d'en créer. Retourne le nombre de sockets adoptés, 0 si aucun processus n'écoute sur
+    // handoff_path (premier démarrage). Lève std::system_error si l'échange échoue.
+    // start() confirme alors l'adoption, mais nos Acceptors n'écoutent qu'une fois que le processus en place a arrêté
+    // d'accepter : les connexions arrivées entre-temps attendent dans le backlog du noyau, jamais deux processus
+    // n'acceptent en même temps.
+    size_t adopt_listeners(const std::string &handoff_path);
+
+    // Processus en place, dans le thread de la boucle principale, après start() : attend un successeur sur handoff_path.
+    // L'échange ne bloque pas la boucle. Quand le successeur a confirmé l'adoption des sockets, on arrête d'accepter,
+    // on le lui signale et on ferme gracieusement nos connexions, puis cb est appelé. Sans confirmation dans le délai,
+    // on continue de servir et on attend le successeur suivant.
+    void serve_handoff(const std::string &handoff_path, std::function<void()> const &cb);
+
+    // Avant start(). Au-delà de max connexions ouvertes (0 : illimité), les listeners sont mis en pause et les
+    // nouvelles connexions attendent dans le backlog du noyau jusqu'à ce qu'une connexion se ferme.
+    void set_max_connections(size_t max) { m_max_connections = max; }
+
+    // Avant start() : même limite mais pour chaque boucle d'E/S
+    void set_max_connections_per_loop(size_t max) { m_max_connections_per_loop = max; }
+
+    // Avant start() : nombre maximal de accept4 par réveil d'un listener (défaut 64, 0 : pas de limite)
+    void set_accept_budget(uint32_t budget) { m_accept_budget = budget; }
+
+    // Avant start() : options TCP des listeners et des connexions acceptées, voir ListenerProfile::request_response()
+    void set_listener_profile(ListenerProfile const &profile) { m_profile = profile; }
+
+    // Avant start() : délai d'inactivité après lequel les connexions rendent leurs buffers, 0 : jamais.
+    // Les octets rendus sont visibles par boucle via EventLoop::idle_reclaimed_bytes().
+    void set_idle_trim(uint32_t seconds) { m_idle_trim_sec = seconds; }
+
+    // Avant start() : lecture maximale d'une connexion par réveil, voir EventLoop::set_read_budget(). 0 : illimité.
+    void set_read_budget(uint32_t bytes, uint32_t calls)
+    {
+        m_read_budget_set = true;
+        m_read_budget_bytes = bytes;
+        m_read_budget_calls = calls;
+    }
+
+    // Avant start() : toutes les connexions acceptées sont en TLS avec ce contexte (voir TlsContext), le callback
+    // "connecté" n'étant appelé qu'après le handshake. Nécessite l'option CMake TCPSERVER_WITH_TLS.
+    // Attention : la construction du TlsContext ignore SIGPIPE pour tout le processus s'il n'a pas de handler
+    // (voir TlsContext::TlsContext), les écritures sur un pair parti échouent alors avec EPIPE.
+    void set_tls(std::shared_ptr<TlsContext> tls) { m_tls = std::move(tls); }
+
+    // Avant start() : EPOLLOUT permanent sur les connexions, voir EventLoop::set_sticky_write_interest()
+    void set_sticky_write_interest(bool sticky) { m_sticky_write_interest = sticky; }
+
+    // Avant start() : surveille la boucle principale et celles du pool, une itération de plus de budget_ms est
+    // signalée avec la pile du thread bloqué (voir LoopWatchdog). 0 : désactivé.
+    void enable_watchdog(uint32_t budget_ms) { m_watchdog_budget_ms = budget_ms; }
+
+    // Avant start() : toutes les period_ms, l'occupation de chaque boucle du pool (temps hors epoll_wait) est mesurée.
+    // Si la plus chargée dépasse high_ratio et nettement la plus libre, jusqu'à max_moves de ses connexions qui lisent
+    // le plus migrent vers celle-ci (TcpConnection::migrate_to). Une connexion plus lourde que la moitié de l'écart
+    // reste en place : la déplacer ne ferait que déplacer le point chaud. 0 : désactivé.
+    void enable_balancer(uint32_t period_ms, double high_ratio = 0.75, uint32_t max_moves = 1)
+    {
+        m_balance_period_ms = period_ms;
+        m_balance_high_ratio = high_ratio;
+        m_balance_max_moves = max_moves;
+    }
+
+    // connexions déplacées par le rééquilibrage
+    [[nodiscard]] uint64_t migrations() const { return m_migrations.load(std::memory_order_relaxed); }
+
+    // compteurs d'admission cumulés de tous les listeners (après start())
+    [[nodiscard]] AdmissionStats admission_stats() const;
+
+    // connexions encore ouvertes sur toutes les boucles, par exemple pour savoir quand quitter après un handoff
+    [[nodiscard]] size_t connection_count() const;
 };
 
 #endif // TCP_SERVER
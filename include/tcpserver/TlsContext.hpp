@@ -0,0 +1,71 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_TLS_CONTEXT)
+#define TKS_TLS_CONTEXT
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "fastlog/not_copyable.hpp"
+
+struct ssl_ctx_st;
+
+struct TlsStats {
+    uint64_t handshakes;         // handshakes terminés
+    uint64_t handshake_failures;
+    uint64_t ktls_tx;            // connexions dont l'envoi est chiffré par le noyau
+    uint64_t ktls_rx;            // ... et la réception déchiffrée par le noyau
+};
+
+// Contexte TLS serveur partagé par toutes les connexions d'un TcpServer (voir TcpServer::set_tls).
+// Après le handshake, mené par OpenSSL dans la boucle de la connexion, les clés sont confiées au noyau (kTLS) s'il
+// le permet : send(), splice() et les payloads partagés restent sans copie ni chiffrement en espace utilisateur.
+// Sinon SSL_read/SSL_write prennent le relais. Disponible seulement avec l'option CMake TCPSERVER_WITH_TLS.
+class TlsContext : notcopyable
+{
+private:
+    ssl_ctx_st *m_ctx{nullptr};
+    bool m_ktls;
+
+    std::atomic<uint64_t> m_handshakes{0};
+    std::atomic<uint64_t> m_handshake_failures{0};
+    std::atomic<uint64_t> m_ktls_tx{0};
+    std::atomic<uint64_t> m_ktls_rx{0};
+
+public:
+    // cert_chain_file et key_file au format PEM. kernel_offload : tenter kTLS après chaque handshake.
+    // Lève std::system_error si le certificat ou la clé sont refusés, ou si TLS n'est pas compilé.
+    // Effet global : si SIGPIPE a encore son action par défaut, il est ignoré pour tout le processus (OpenSSL et kTLS
+    // écrivent sans MSG_NOSIGNAL). Un programme qui a besoin de SIGPIPE doit installer son handler avant.
+    TlsContext(std::string const &cert_chain_file, std::string const &key_file, bool kernel_offload = true);
+
+    ~TlsContext();
+
+    [[nodiscard]] ssl_ctx_st *native() const { return m_ctx; }
+
+    [[nodiscard]] bool kernel_offload() const { return m_ktls; }
+
+    void count_handshake(bool success)
+    {
+        (success ? m_handshakes : m_handshake_failures).fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void count_ktls(bool tx, bool rx)
+    {
+        if (tx) m_ktls_tx.fetch_add(1, std::memory_order_relaxed);
+        if (rx) m_ktls_rx.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] TlsStats stats() const
+    {
+        return TlsStats{m_handshakes.load(std::memory_order_relaxed), m_handshake_failures.load(std::memory_order_relaxed),
+                        m_ktls_tx.load(std::memory_order_relaxed), m_ktls_rx.load(std::memory_order_relaxed)};
+    }
+};
+
+#endif // TKS_TLS_CONTEXT
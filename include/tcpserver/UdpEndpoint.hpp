@@ -0,0 +1,140 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_UDP_ENDPOINT)
+#define TKS_UDP_ENDPOINT
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <sys/socket.h>
+
+#include "fastlog/not_copyable.hpp"
+#include "PeerAddress.hpp"
+
+// datagrammes lus par recvmmsg
+#define UDP_RECV_BATCH 32
+// taille d'un slot de réception sans GRO, les datagrammes plus grands sont comptés tronqués et ignorés
+#define UDP_SLOT_SIZE 2048
+// avec GRO un slot reçoit jusqu'à 64 Ko de segments agrégés
+#define UDP_GRO_SLOT_SIZE 65536
+// messages par sendmmsg
+#define UDP_SEND_BATCH 32
+// limites du noyau pour UDP_SEGMENT : segments par envoi et charge utile totale
+#define UDP_GSO_MAX_SEGMENTS 64
+#define UDP_MAX_PAYLOAD 65507
+// segment le plus grand regroupé par GSO : un segment au-delà du MTU du chemin ferait échouer tout l'envoi
+#define UDP_GSO_MAX_SEGMENT_SIZE 1472
+// octets en attente d'envoi au-delà desquels send_to() refuse
+#define UDP_SEND_QUEUE_MAX (4 * 1024 * 1024)
+
+class EventLoop;
+class Channel;
+
+// un datagramme reçu (un segment si GRO), data n'est valable que pendant l'appel
+using UdpDatagramCallback = std::function<void(PeerAddress const &from, const uint8_t *data, uint32_t length, int64_t time)>;
+
+// Socket UDP servi par une EventLoop existante, à côté des connexions TCP.
+// La réception lit jusqu'à UDP_RECV_BATCH datagrammes par recvmmsg dans des slots alloués une fois, agrégés par
+// le noyau si UDP_GRO est actif. Les envois de l'itération sont copiés dans une file et partent ensemble à la fin de
+// celle-ci par sendmmsg ; les datagrammes consécutifs de même taille vers le même destinataire forment un seul
+// message UDP_SEGMENT (GSO). Avec SO_REUSEPORT, un UdpEndpoint par boucle du pool (TcpServer::loops()) partage le
+// port et le noyau répartit les flux, comme les Acceptors en TCP.
+// Construit hors boucle si besoin, mais start(), send_to() et le destructeur sont dans le thread de la boucle.
+class UdpEndpoint : notcopyable
+{
+private:
+    struct OutDatagram {
+        PeerAddress to;
+        uint32_t offset; // dans m_out_bytes
+        uint32_t length;
+    };
+
+    EventLoop *m_loop;
+    std::unique_ptr<Channel> m_channel;
+    uint16_t m_port;
+    bool m_started{false};
+    bool m_gro{false};
+    bool m_gso{true};
+    bool m_flush_queued{false};
+    bool m_read_resume_queued{false};
+    UdpDatagramCallback m_on_datagram;
+    // expire avec l'UdpEndpoint : les tâches postées dans la boucle le testent avant de toucher à this
+    std::shared_ptr<bool> m_alive{std::make_shared<bool>(true)};
+
+    // réception : slots et en-têtes préparés une fois pour recvmmsg
+    uint32_t m_slot_size{UDP_SLOT_SIZE};
+    std::vector<uint8_t> m_slots;
+    std::vector<mmsghdr> m_recv_msgs;
+    std::vector<iovec> m_recv_iovs;
+    std::vector<sockaddr_storage> m_recv_addrs;
+    std::vector<char> m_recv_control;
+
+    // envoi : datagrammes contigus dans m_out_bytes, m_out_sent déjà partis
+    std::vector<uint8_t> m_out_bytes;
+    std::vector<OutDatagram> m_out;
+    size_t m_out_sent{0};
+
+    uint64_t m_received{0};
+    uint64_t m_recv_calls{0};
+    uint64_t m_truncated{0};
+    uint64_t m_sent{0};
+    uint64_t m_send_calls{0};
+    uint64_t m_dropped{0};
+
+    void handle_read(int64_t receive_time);
+
+    void handle_error();
+
+    void flush();
+
+    void schedule_flush();
+
+public:
+    // Lie un socket UDP sur INADDR_ANY:port (0 : port choisi par le noyau). Lève std::system_error.
+    UdpEndpoint(EventLoop *loop, uint16_t port, bool reuse_port = true, int32_t snd_buff = 0, int32_t rcv_buff = 0);
+
+    ~UdpEndpoint();
+
+    // Avant start() : agrégation des datagrammes en réception (UDP_GRO). Retourne false si le noyau la refuse.
+    bool enable_gro();
+
+    // Avant start() : désactive UDP_SEGMENT à l'envoi (il l'est aussi d'office si le noyau le refuse)
+    void disable_gso() { m_gso = false; }
+
+    void set_on_datagram(UdpDatagramCallback cb) { m_on_datagram = std::move(cb); }
+
+    // À appeler dans le thread de la boucle
+    void start();
+
+    // Dans le thread de la boucle : copie le datagramme, envoyé à la fin de l'itération avec les autres.
+    // Retourne false s'il est ignoré (plus grand que UDP_MAX_PAYLOAD, file pleine ou destinataire non IPv4).
+    bool send_to(PeerAddress const &to, const uint8_t *data, uint32_t length);
+
+    [[nodiscard]] uint16_t port() const { return m_port; }
+
+    [[nodiscard]] int fd() const;
+
+    [[nodiscard]] bool gro() const { return m_gro; }
+
+    [[nodiscard]] bool gso() const { return m_gso; }
+
+    // compteurs, dans le thread de la boucle
+    [[nodiscard]] uint64_t received() const { return m_received; }
+
+    [[nodiscard]] uint64_t recv_calls() const { return m_recv_calls; }
+
+    [[nodiscard]] uint64_t truncated() const { return m_truncated; }
+
+    [[nodiscard]] uint64_t sent() const { return m_sent; }
+
+    [[nodiscard]] uint64_t send_calls() const { return m_send_calls; }
+
+    [[nodiscard]] uint64_t dropped() const { return m_dropped; }
+};
+
+#endif // TKS_UDP_ENDPOINT
@@ -0,0 +1,66 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#if !defined(TKS_UPSTREAM_POOL)
+#define TKS_UPSTREAM_POOL
+
+#include <memory>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "fastlog/not_copyable.hpp"
+
+class EventLoop;
+class TcpClient;
+class TcpConnection;
+class ProtoBuffer;
+
+// Pool de connexions amont "chaudes" propre à une seule boucle. Un pool par boucle du EventLoopThreadPool :
+// une requête reçue sur une boucle atteint le backend sans jamais changer de thread.
+// Toutes les méthodes doivent être appelées dans le thread de la boucle (start() peut l'être depuis un autre thread).
+class UpstreamPool : notcopyable
+{
+private:
+    EventLoop *m_loop;
+    std::string m_ip;
+    uint16_t m_port;
+    uint32_t m_size;
+    std::vector<std::unique_ptr<TcpClient>> m_clients;
+    std::vector<std::shared_ptr<TcpConnection>> m_idle; // LIFO : la dernière connexion rendue est la plus chaude
+
+    std::function<void(const std::shared_ptr<TcpConnection> &, ProtoBuffer *buf, int64_t time)> m_data_received_cb;
+    std::function<void(std::shared_ptr<TcpConnection> const &)> m_connection_state_change_cb;
+
+    void on_connection_state_change(std::shared_ptr<TcpConnection> const &conn);
+
+    void remove_idle(std::shared_ptr<TcpConnection> const &conn);
+
+public:
+    UpstreamPool(EventLoop *loop, std::string ip, uint16_t port, uint32_t size);
+
+    ~UpstreamPool();
+
+    void start();
+
+    // une connexion établie et libre, ou nullptr si toutes sont occupées ou en cours de connexion
+    std::shared_ptr<TcpConnection> acquire();
+
+    void release(std::shared_ptr<TcpConnection> const &conn);
+
+    [[nodiscard]] size_t idle_count() const { return m_idle.size(); }
+
+    [[nodiscard]] uint32_t size() const { return m_size; }
+
+    [[nodiscard]] EventLoop *event_loop() const { return m_loop; }
+
+    // réponses du backend, quelle que soit la connexion du pool
+    void set_on_data_received(std::function<void(const std::shared_ptr<TcpConnection> &, ProtoBuffer *buf, int64_t time)> const &cb) { m_data_received_cb = cb; }
+
+    void set_on_connection_state_change(std::function<void(std::shared_ptr<TcpConnection> const &)> const &cb) { m_connection_state_change_cb = cb; }
+};
+
+#endif // TKS_UPSTREAM_POOL
@@ -7,19 +7,24 @@
 #include "EventLoop.hpp"
 #include "Channel.hpp"
 #include "TcpConnection.hpp"
+#include "Connector.hpp"
+#include "AdmissionControl.hpp"
+#include "PeerAddress.hpp"
+#include "Timer.h"
 #include <fastlog/FastLog.h>
 
 #include <sys/socket.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <cstring>
-#include <atomic>
 #include <cassert>
 
-static std::atomic_long next_conn_id;
+// listener en pause faute de fd (EMFILE sans fd de réserve) : nouvel essai après ce délai, ou à la prochaine fermeture
+#define ACCEPT_NO_FD_RETRY_MS 100
 
-Acceptor::Acceptor(EventLoop* loop, int listen_port, int32_t snd_buff, int32_t rcv_buff) : m_loop(loop), m_listening_port(listen_port)
+Acceptor::Acceptor(EventLoop* loop, int listen_port, int32_t snd_buff, int32_t rcv_buff) : m_loop(loop), m_listening_port(listen_port), m_family(AF_INET)
 {
     // Create an AF_INET stream socket to receive incoming connections on
     int m_server_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
@@ -82,11 +87,74 @@ Acceptor::Acceptor(EventLoop* loop, int listen_port, int32_t snd_buff, int32_t r
 
     m_channel = std::make_unique<Channel>(loop, m_server_fd);
     m_channel->set_read_cb([this](int64_t time) { handleRead(time); });
+    m_spare_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+Acceptor::Acceptor(EventLoop *loop, int listen_fd) : m_loop(loop), m_listening_port(0), m_family(AF_UNSPEC)
+{
+    sockaddr_storage addr{};
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(listen_fd, (sockaddr *) &addr, &addr_len) != 0)
+    {
+        const int local_errno = errno;
+        ::close(listen_fd);
+        throw std::system_error(local_errno, std::generic_category(), "getsockname()");
+    }
+
+    m_family = addr.ss_family;
+    if (m_family == AF_INET)
+    {
+        m_listening_port = ntohs(((sockaddr_in *) &addr)->sin_port);
+    }
+    else if (m_family == AF_INET6)
+    {
+        m_listening_port = ntohs(((sockaddr_in6 *) &addr)->sin6_port);
+    }
+
+    m_channel = std::make_unique<Channel>(loop, listen_fd);
+    m_channel->set_read_cb([this](int64_t time) { handleRead(time); });
+    m_spare_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+int Acceptor::create_unix_socket(const std::string &path)
+{
+    sockaddr_storage addr{};
+    const socklen_t addr_len = Connector::make_unix_address(path, &addr);
+    if (addr_len == 0)
+    {
+        throw std::system_error(ENAMETOOLONG, std::generic_category(), "unix socket path");
+    }
+
+    if (path[0] != '@')
+    {
+        // Un fichier socket laissé par une instance précédente ferait échouer bind()
+        ::unlink(path.c_str());
+    }
+
+    int server_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "socket()");
+    }
+
+    if (bind(server_fd, (sockaddr *) &addr, addr_len) != 0)
+    {
+        const int local_errno = errno;
+        ::close(server_fd);
+        throw std::system_error(local_errno, std::generic_category(), "bind()");
+    }
+    return server_fd;
+}
+
+void Acceptor::set_exclusive_wakeup()
+{
+    m_channel->set_exclusive_wakeup(true);
 }
 
 void Acceptor::listen()
 {
     m_loop->assertInLoopThread();
+    apply_listener_profile();
     m_channel->enable_reading();
     m_listening = true;
     // Set the listen backlog
@@ -106,11 +174,37 @@ void Acceptor::listen()
 void Acceptor::handleRead(int64_t)
 {
     m_loop->assertInLoopThread();
+    m_resume_scheduled = false;
+    if (m_channel == nullptr || m_paused)
+    {
+        return;
+    }
 
-    // server socket; call accept as many times as we can
-    for (;;)
+    // server socket; call accept as many times as the budget allows
+    for (uint32_t n = 0;; ++n)
     {
-        sockaddr_in in_addr{};
+        if (m_accept_budget != 0 && n >= m_accept_budget)
+        {
+            // en mode edge-triggered epoll ne nous renotifiera pas : on reprend à l'itération suivante,
+            // après les événements des connexions déjà établies
+            if (m_admission != nullptr)
+            {
+                m_admission->count_budget_exhausted();
+            }
+            m_resume_scheduled = true;
+            m_loop->queue_next_iteration([this, alive = std::weak_ptr<bool>(m_alive)] {
+                if (!alive.expired()) handleRead(0);
+            });
+            break;
+        }
+
+        if (!has_room())
+        {
+            pause();
+            break;
+        }
+
+        sockaddr_storage in_addr{};
         socklen_t in_addr_len = sizeof(in_addr);
         int new_client_fd = ::accept4(m_channel->fd(), (sockaddr*)&in_addr, &in_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
         const int local_errno = errno;
@@ -120,48 +214,298 @@ void Acceptor::handleRead(int64_t)
             {
                 break;
             }
-            std::fprintf(stderr, "[EventLoop] accept4: %s\n", std::strerror(local_errno));
+            if (local_errno == EMFILE || local_errno == ENFILE)
+            {
+                // la connexion resterait dans la file et epoll ne la renotifierait plus : on la refuse proprement
+                if (reject_no_fd())
+                {
+                    continue;
+                }
+                // impossible de la retirer : réessayer aussitôt tournerait à vide
+                pause_no_fd();
+                break;
+            }
+            if (m_admission != nullptr)
+            {
+                m_admission->count_accept_error();
+            }
+            // ECONNABORTED, EPERM... : erreur propre à une connexion, les suivantes restent acceptables.
+            // Le budget borne la boucle même si l'erreur se répète.
+            DEBUG_W("Acceptor on port %d: accept4: %s", m_listening_port, std::strerror(local_errno));
             continue;
         }
 
-        if (int yes = 1; setsockopt(new_client_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)) != 0)
+        if (m_admission != nullptr)
+        {
+            m_admission->admitted();
+        }
+
+        if (m_family != AF_UNIX)
         {
-            perror("Fail to set tcp no delay on client");
+            // AF_UNIX : pas de pile TCP, ni options TCP ni adresse ip, le pair est généralement anonyme
+            apply_connection_profile(new_client_fd);
         }
 
-        char c_addr[INET6_ADDRSTRLEN];
-        inet_ntop(in_addr.sin_family, (void*)&(in_addr.sin_addr), c_addr, INET6_ADDRSTRLEN);
+        // l'adresse est gardée brute, elle ne sera formatée que si quelqu'un la demande
+        on_new_connection(new_client_fd, PeerAddress((sockaddr *) &in_addr, in_addr_len));
+    }
+}
+
+void Acceptor::apply_listener_profile()
+{
+    if (m_family == AF_UNIX)
+    {
+        return;
+    }
+
+    // options facultatives : un noyau qui les refuse n'empêche pas d'écouter
+    const int fd = m_channel->fd();
+    if (m_profile.fastopen_queue > 0 && setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &m_profile.fastopen_queue, sizeof(int)) != 0)
+    {
+        DEBUG_W("Acceptor on port %d: TCP_FASTOPEN: %s", m_listening_port, std::strerror(errno));
+    }
+    if (m_profile.defer_accept_sec > 0 && setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &m_profile.defer_accept_sec, sizeof(int)) != 0)
+    {
+        DEBUG_W("Acceptor on port %d: TCP_DEFER_ACCEPT: %s", m_listening_port, std::strerror(errno));
+    }
+}
 
-        on_new_connection(new_client_fd, c_addr, ntohs(in_addr.sin_port), in_addr.sin_family);
+void Acceptor::apply_connection_profile(int sock_fd) const
+{
+    int yes = 1;
+    if (m_profile.nodelay && setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)) != 0)
+    {
+        perror("Fail to set tcp no delay on client");
+    }
+    if (m_profile.quickack && setsockopt(sock_fd, IPPROTO_TCP, TCP_QUICKACK, &yes, sizeof(yes)) != 0)
+    {
+        perror("Fail to set tcp quick ack on client");
+    }
+    if (m_profile.rcvlowat > 0 && setsockopt(sock_fd, SOL_SOCKET, SO_RCVLOWAT, &m_profile.rcvlowat, sizeof(int)) != 0)
+    {
+        perror("Fail to set rcv low at on client");
     }
 }
 
-void Acceptor::on_new_connection(int sock_fd, const std::string& ip, uint16_t port, int family)
+void Acceptor::on_new_connection(int sock_fd, PeerAddress const &peer)
 {
     m_loop->assertInLoopThread();
 
-    auto conn = std::make_shared<TcpConnection>(m_loop, sock_fd, ip, port, family, ++next_conn_id);
+    auto conn = std::make_shared<TcpConnection>(m_loop, sock_fd, peer, TcpConnection::generate_id());
     m_connections[conn->conn_id()] = conn;
-    DEBUG_D("New connection %s:%d sock_fd : %d family %d id %ld", ip.c_str(), port, sock_fd, family, conn->conn_id());
+    m_connection_count.store(m_connections.size(), std::memory_order_relaxed);
+    DEBUG_D("New connection sock_fd : %d family %d id %ld", sock_fd, peer.family(), conn->conn_id());
 
-    conn->set_on_connection_state_change(m_connection_state_change_cb);
-    conn->set_on_data_received(m_data_received_cb);
-    conn->set_on_write_complete(m_write_complete_cb);
-    conn->set_on_connection_closed([this](const auto& _arg) { remove_connection_internal(_arg); });
+    if (m_conn_callbacks == nullptr)
+    {
+        auto callbacks = std::make_shared<ConnectionCallbacks>();
+        callbacks->state_change = m_connection_state_change_cb;
+        callbacks->data_received = m_data_received_cb;
+        callbacks->write_complete = m_write_complete_cb;
+        if (m_profile.rcvlowat > 0)
+        {
+            callbacks->rcvlowat = m_profile.rcvlowat;
+        }
+        callbacks->closed = [this](const auto &_arg)
+        {
+            // une connexion migrée (TcpConnection::migrate_to) se ferme dans le thread d'une autre boucle
+            if (m_loop->isInLoopThread())
+            {
+                remove_connection_internal(_arg);
+                return;
+            }
+            m_loop->queue([this, alive = std::weak_ptr<bool>(m_alive), conn = _arg] {
+                if (!alive.expired()) remove_connection_internal(conn);
+            });
+        };
+        callbacks->fill_noop();
+        m_conn_callbacks = std::move(callbacks);
+    }
+    conn->set_callbacks(m_conn_callbacks);
+    if (m_tls != nullptr)
+    {
+        conn->start_tls(m_tls);
+    }
     m_loop -> queue([conn] {conn->connection_established();});
 }
 
 void Acceptor::remove_connection_internal(std::shared_ptr<TcpConnection> const &conn) {
     m_loop->assertInLoopThread();
-    DEBUG_D("TcpServer::removeConnection - connection %ld [%s]", conn->conn_id(), conn->ip_addr().c_str());
+    DEBUG_D("TcpServer::removeConnection - connection %ld", conn->conn_id());
     const size_t n = m_connections.erase(conn->conn_id());
     assert(n == 1);
     (void) n;
-    m_loop->queue([conn] { conn->connection_destroyed(); });
+    m_connection_count.store(m_connections.size(), std::memory_order_relaxed);
+    conn->event_loop()->queue([conn] { conn->connection_destroyed(); });
+
+    if (m_admission != nullptr)
+    {
+        m_admission->released();
+    }
+    if (m_paused)
+    {
+        resume();
+    }
+}
+
+bool Acceptor::has_room() const
+{
+    if (m_max_connections != 0 && m_connections.size() >= m_max_connections)
+    {
+        return false;
+    }
+    return m_admission == nullptr || m_admission->has_room();
+}
+
+void Acceptor::pause()
+{
+    if (m_paused || !m_listening)
+    {
+        return;
+    }
+    // les connexions en attente restent dans la file du noyau (backlog) jusqu'à la reprise
+    m_channel->disable_all();
+    m_paused = true;
+    DEBUG_W("Acceptor on port %d paused: %zu connections", m_listening_port, m_connections.size());
+    if (m_admission != nullptr)
+    {
+        m_admission->count_paused();
+        if (!m_admission->has_room())
+        {
+            m_admission->park(this);
+        }
+    }
+}
+
+void Acceptor::resume()
+{
+    m_loop->assertInLoopThread();
+    if (!m_paused || m_channel == nullptr)
+    {
+        return;
+    }
+    if (!has_room())
+    {
+        // une autre boucle a repris la place libérée : on se remet en attente de la limite globale
+        if (m_admission != nullptr && !m_admission->has_room())
+        {
+            m_admission->park(this);
+        }
+        return;
+    }
+    if (m_admission != nullptr)
+    {
+        m_admission->unpark(this);
+    }
+    m_paused = false;
+    m_channel->enable_reading();
+    // edge-triggered : les connexions arrivées pendant la pause ne génèrent pas forcément de nouvel événement
+    if (!m_resume_scheduled)
+    {
+        m_resume_scheduled = true;
+        m_loop->queue_next_iteration([this, alive = std::weak_ptr<bool>(m_alive)] {
+            if (!alive.expired()) handleRead(0);
+        });
+    }
+}
+
+void Acceptor::post_resume()
+{
+    // toujours différé, même dans le thread de la boucle : l'appelant peut tenir le verrou d'AdmissionControl
+    m_loop->queue([this, alive = std::weak_ptr<bool>(m_alive)] {
+        if (!alive.expired()) resume();
+    });
+}
+
+bool Acceptor::reject_no_fd()
+{
+    if (m_spare_fd < 0)
+    {
+        // la réouverture a échoué la dernière fois, un fd a pu se libérer depuis
+        m_spare_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    if (m_spare_fd < 0)
+    {
+        return false;
+    }
+    if (m_admission != nullptr)
+    {
+        m_admission->count_rejected_no_fd();
+    }
+    ::close(m_spare_fd);
+    m_spare_fd = -1;
+    if (int fd = ::accept4(m_channel->fd(), nullptr, nullptr, SOCK_CLOEXEC); fd >= 0)
+    {
+        ::close(fd);
+    }
+    m_spare_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    DEBUG_W("Acceptor on port %d: out of file descriptors, connection rejected", m_listening_port);
+    return true;
+}
+
+void Acceptor::pause_no_fd()
+{
+    DEBUG_E("Acceptor on port %d: out of file descriptors, retrying in %d ms", m_listening_port, ACCEPT_NO_FD_RETRY_MS);
+    pause();
+    if (m_no_fd_timer == nullptr)
+    {
+        m_no_fd_timer = std::make_unique<Timer>([this] { resume(); }, m_loop);
+    }
+    m_no_fd_timer->stop();
+    m_no_fd_timer->set_timeout(ACCEPT_NO_FD_RETRY_MS, false);
+    m_no_fd_timer->start();
+}
+
+void Acceptor::stop_listening()
+{
+    m_loop->assertInLoopThread();
+    if (m_channel == nullptr)
+    {
+        return;
+    }
+
+    const int fd = m_channel->fd();
+    if (m_listening)
+    {
+        m_channel->disable_all();
+        m_loop->remove_channel(m_channel.get());
+        m_listening = false;
+    }
+    ::close(fd);
+    m_channel = nullptr;
+    m_paused = false;
+    if (m_admission != nullptr)
+    {
+        m_admission->unpark(this);
+    }
+    DEBUG_D("Acceptor on port %d stopped listening, %zu connections left", m_listening_port, m_connections.size());
+}
+
+void Acceptor::drain()
+{
+    m_loop->assertInLoopThread();
+    for (auto const &item: m_connections)
+    {
+        item.second->graceful_shutdown();
+    }
+}
+
+int Acceptor::listen_fd() const
+{
+    return m_channel == nullptr ? -1 : m_channel->fd();
 }
 
 Acceptor::~Acceptor()
 {
+    m_alive.reset();
+    if (m_admission != nullptr)
+    {
+        m_admission->unpark(this);
+    }
+    if (m_spare_fd >= 0)
+    {
+        ::close(m_spare_fd);
+    }
     if (m_channel != nullptr)
     {
         const int fd = m_channel->fd();
@@ -0,0 +1,71 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "AdmissionControl.hpp"
+#include "Acceptor.hpp"
+#include "EventLoop.hpp"
+
+#include <algorithm>
+
+void AdmissionControl::released()
+{
+    m_active.fetch_sub(1, std::memory_order_relaxed);
+    if (m_has_parked.load(std::memory_order_acquire) && has_room())
+    {
+        resume_parked();
+    }
+}
+
+void AdmissionControl::park(Acceptor *acceptor)
+{
+    {
+        std::lock_guard lock(m_mutex);
+        if (std::find(m_parked.begin(), m_parked.end(), acceptor) == m_parked.end())
+        {
+            m_parked.push_back(acceptor);
+        }
+        m_has_parked.store(true, std::memory_order_release);
+    }
+
+    // une connexion a pu se fermer entre le contrôle et la mise en attente
+    if (has_room())
+    {
+        resume_parked();
+    }
+}
+
+void AdmissionControl::unpark(Acceptor *acceptor)
+{
+    std::lock_guard lock(m_mutex);
+    m_parked.erase(std::remove(m_parked.begin(), m_parked.end(), acceptor), m_parked.end());
+    m_has_parked.store(!m_parked.empty(), std::memory_order_release);
+}
+
+void AdmissionControl::resume_parked()
+{
+    // sous le verrou : un Acceptor en cours de destruction attend dans unpark() que la reprise soit postée, et la
+    // tâche postée vérifie qu'il existe encore
+    std::lock_guard lock(m_mutex);
+    std::vector<Acceptor *> parked;
+    parked.swap(m_parked);
+    m_has_parked.store(false, std::memory_order_release);
+    for (Acceptor *acceptor: parked)
+    {
+        acceptor->post_resume();
+    }
+}
+
+AdmissionStats AdmissionControl::stats() const
+{
+    return AdmissionStats{
+            m_accepted.load(std::memory_order_relaxed),
+            m_rejected_no_fd.load(std::memory_order_relaxed),
+            m_accept_errors.load(std::memory_order_relaxed),
+            m_budget_exhausted.load(std::memory_order_relaxed),
+            m_paused.load(std::memory_order_relaxed),
+            m_active.load(std::memory_order_relaxed),
+    };
+}
@@ -0,0 +1,118 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "BroadcastGroup.hpp"
+#include "SharedPayload.hpp"
+#include "TcpConnection.hpp"
+#include "EventLoop.hpp"
+#include <fastlog/FastLog.h>
+
+BroadcastGroup::BroadcastGroup(std::vector<EventLoop *> const &loops)
+{
+    for (auto *loop: loops)
+    {
+        auto members = std::make_shared<LoopMembers>();
+        members->loop = loop;
+        m_loops.push_back(std::move(members));
+    }
+}
+
+std::shared_ptr<BroadcastGroup::LoopMembers> BroadcastGroup::members_of(EventLoop *loop) const
+{
+    for (auto const &members: m_loops)
+    {
+        if (members->loop == loop)
+        {
+            return members;
+        }
+    }
+    return nullptr;
+}
+
+void BroadcastGroup::join(std::shared_ptr<TcpConnection> const &conn)
+{
+    auto members = members_of(conn->event_loop());
+    if (members == nullptr)
+    {
+        DEBUG_E("BroadcastGroup::join conn %ld: loop not part of the group", conn->conn_id());
+        return;
+    }
+
+    std::weak_ptr<TcpConnection> weak = conn;
+    const long conn_id = conn->conn_id();
+    members->loop->run([members, weak, conn_id]
+    {
+        members->members[conn_id] = weak;
+        members->count.store(members->members.size(), std::memory_order_relaxed);
+    });
+}
+
+void BroadcastGroup::leave(std::shared_ptr<TcpConnection> const &conn)
+{
+    // la connexion a pu migrer depuis join() : elle est retirée de la boucle où elle a été inscrite, quelle qu'elle soit
+    const long conn_id = conn->conn_id();
+    for (auto const &members: m_loops)
+    {
+        members->loop->run([members, conn_id]
+        {
+            if (members->members.erase(conn_id) != 0)
+            {
+                members->count.store(members->members.size(), std::memory_order_relaxed);
+            }
+        });
+    }
+}
+
+void BroadcastGroup::publish(ProtoBuffer *buffer)
+{
+    publish(SharedPayload::create(buffer));
+}
+
+void BroadcastGroup::publish(std::shared_ptr<const SharedPayload> const &payload)
+{
+    for (auto const &members: m_loops)
+    {
+        if (members->count.load(std::memory_order_relaxed) == 0)
+        {
+            continue;
+        }
+
+        members->loop->run([members, payload]
+        {
+            for (auto it = members->members.begin(); it != members->members.end();)
+            {
+                auto conn = it->second.lock();
+                if (conn == nullptr || !conn->is_connected())
+                {
+                    it = members->members.erase(it);
+                    continue;
+                }
+                if (conn->owned_by_current_thread())
+                {
+                    // cas courant : ni shared_from_this ni tâche par membre
+                    conn->write_shared_internal(payload);
+                }
+                else
+                {
+                    // migrée depuis join(), ou en cours de migration
+                    conn->write_shared(payload);
+                }
+                ++it;
+            }
+            members->count.store(members->members.size(), std::memory_order_relaxed);
+        });
+    }
+}
+
+size_t BroadcastGroup::member_count() const
+{
+    size_t total = 0;
+    for (auto const &members: m_loops)
+    {
+        total += members->count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
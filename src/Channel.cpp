@@ -6,6 +6,7 @@
 
 #include "Channel.hpp"
 #include "EventLoop.hpp"
+#include <cassert>
 #include <iostream>
 
 const uint32_t Channel::kReadEvent = EPOLLIN | EPOLLPRI | EPOLLRDHUP;
@@ -13,10 +14,29 @@ const uint32_t Channel::kWriteEvent = EPOLLOUT;
 const uint32_t Channel::kNoneEvent = 0;
 
 Channel::Channel(EventLoop *loop, const int fd_arg, const bool periodic_notification) :
-    m_loop(loop), m_fd(fd_arg), m_with_pn(periodic_notification), m_mark(ChannelMark::NEW)
+    m_loop(loop), m_fd(fd_arg), m_mark(ChannelMark::NEW), m_with_pn(periodic_notification)
 {
 }
 
+// un Channel par connexion : sa taille compte pour le coût d'une connexion inactive
+static_assert(sizeof(Channel) <= 48, "Channel should stay within 48 bytes");
+
+Channel::Callbacks *Channel::callbacks()
+{
+    if (m_callbacks == nullptr)
+    {
+        m_callbacks = std::make_unique<Callbacks>();
+    }
+    return m_callbacks.get();
+}
+
+void Channel::move_to(EventLoop *loop)
+{
+    assert(is_none_events() && m_pn_index < 0 && !m_update_pending && m_mark != ChannelMark::ADDED);
+    m_loop = loop;
+    m_mark = ChannelMark::NEW;
+}
+
 void Channel::update()
 {
     m_loop->updateChannel(this); // just to reach event manager
@@ -25,28 +45,50 @@ void Channel::update()
 void Channel::on_events(const int64_t receiveTime) const
 {
     const uint32_t r_events = m_revents;
+    if (m_handler != nullptr)
+    {
+        if (r_events & EPOLLERR)
+        {
+            std::cerr << "ERROR FROM events \n";
+            m_handler->on_channel_error();
+            return;
+        }
+        if (r_events & (EPOLLIN | EPOLLPRI | EPOLLRDHUP)) m_handler->on_channel_read(receiveTime);
+        if (r_events & EPOLLOUT) m_handler->on_channel_write();
+        if (r_events & EPOLLHUP) m_handler->on_channel_close();
+        return;
+    }
+
+    if (m_callbacks == nullptr)
+    {
+        return;
+    }
     if(r_events & EPOLLERR){
         std::cerr << "ERROR FROM events \n";
-        if (m_error_cb) m_error_cb();
+        if (m_callbacks->error) m_callbacks->error();
         return;
     }
     if(r_events & (EPOLLIN | EPOLLPRI | EPOLLRDHUP))
     {
-        if (m_read_cb) m_read_cb(receiveTime);
+        if (m_callbacks->read) m_callbacks->read(receiveTime);
     }
     if(r_events & EPOLLOUT)
     {
-        if (m_write_cb) m_write_cb();
+        if (m_callbacks->write) m_callbacks->write();
     }
     if (r_events & EPOLLHUP) {
-        if (m_close_cb) m_close_cb();
+        if (m_callbacks->close) m_callbacks->close();
     }
 }
 
 void Channel::on_periodic_notification(const int64_t now) const
 {
-    if (m_periodic_notification_cb)
+    if (m_handler != nullptr)
+    {
+        m_handler->on_channel_periodic(now);
+    }
+    else if (m_callbacks != nullptr && m_callbacks->periodic_notification)
     {
-        m_periodic_notification_cb(now);
+        m_callbacks->periodic_notification(now);
     }
 }
@@ -0,0 +1,175 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "ComputePool.hpp"
+#include "fastlog/FastLog.h"
+
+#include <cassert>
+
+// worker courant, pour que les sous-tâches restent dans sa file
+__thread ComputePool *t_compute_pool = nullptr;
+__thread uint32_t t_compute_index = 0;
+
+ComputePool::ComputePool(uint32_t num_workers) : m_num_workers(num_workers == 0 ? 1 : num_workers)
+{
+    for (uint32_t i = 0; i < m_num_workers; ++i)
+    {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+}
+
+ComputePool::~ComputePool()
+{
+    stop();
+}
+
+void ComputePool::start()
+{
+    assert(!m_running);
+    m_running = true;
+    m_stop.store(false);
+    for (uint32_t i = 0; i < m_num_workers; ++i)
+    {
+        m_workers[i]->thread = std::thread([this, i] { run(i); });
+    }
+    DEBUG_I("Compute pool started with %u workers", m_num_workers);
+}
+
+void ComputePool::stop()
+{
+    if (!m_running)
+    {
+        return;
+    }
+    {
+        std::lock_guard lock(m_sleep_mutex);
+        m_stop.store(true);
+    }
+    m_wakeup.notify_all();
+    for (auto &worker: m_workers)
+    {
+        worker->thread.join();
+    }
+    for (auto &worker: m_workers)
+    {
+        std::lock_guard lock(worker->mutex);
+        worker->tasks.clear();
+    }
+    m_pending.store(0);
+    m_running = false;
+}
+
+void ComputePool::submit(std::function<void()> task)
+{
+    m_submitted.fetch_add(1, std::memory_order_relaxed);
+    const uint32_t index = t_compute_pool == this
+                           ? t_compute_index
+                           : m_next.fetch_add(1, std::memory_order_relaxed) % m_num_workers;
+    push(index, std::move(task));
+}
+
+void ComputePool::push(uint32_t index, std::function<void()> task)
+{
+    Worker &worker = *m_workers[index];
+    size_t depth;
+    {
+        std::lock_guard lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+        depth = worker.tasks.size();
+    }
+
+    uint64_t max_depth = m_max_depth.load(std::memory_order_relaxed);
+    while (depth > max_depth && !m_max_depth.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed))
+    {
+    }
+
+    // pairé avec run() : soit le worker voit m_pending avant de dormir, soit on le voit inactif et on le réveille
+    m_pending.fetch_add(1);
+    if (m_idle.load() > 0)
+    {
+        {
+            std::lock_guard lock(m_sleep_mutex);
+        }
+        m_wakeup.notify_one();
+    }
+}
+
+bool ComputePool::take(uint32_t index, std::function<void()> *task)
+{
+    {
+        Worker &own = *m_workers[index];
+        std::lock_guard lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            *task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            m_pending.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // vol par le début de la file, la plus ancienne tâche, en partant du voisin
+    for (uint32_t i = 1; i < m_num_workers; ++i)
+    {
+        Worker &victim = *m_workers[(index + i) % m_num_workers];
+        std::unique_lock lock(victim.mutex, std::try_to_lock);
+        if (!lock.owns_lock() || victim.tasks.empty())
+        {
+            continue;
+        }
+        *task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        m_pending.fetch_sub(1);
+        m_stolen.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void ComputePool::run(uint32_t index)
+{
+    t_compute_pool = this;
+    t_compute_index = index;
+
+    std::function<void()> task;
+    while (!m_stop.load(std::memory_order_relaxed))
+    {
+        if (take(index, &task))
+        {
+            try
+            {
+                task();
+            }
+            catch (const std::exception &e)
+            {
+                DEBUG_E("Compute task failed: %s", e.what());
+            }
+            task = nullptr;
+            m_executed.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        std::unique_lock lock(m_sleep_mutex);
+        m_idle.fetch_add(1);
+        // try_lock peut avoir sauté une file occupée : on ne dort que si rien n'est en attente
+        m_wakeup.wait(lock, [this] { return m_stop.load() || m_pending.load() > 0; });
+        m_idle.fetch_sub(1);
+    }
+
+    t_compute_pool = nullptr;
+}
+
+ComputePoolStats ComputePool::stats() const
+{
+    return ComputePoolStats{
+            m_submitted.load(std::memory_order_relaxed),
+            m_executed.load(std::memory_order_relaxed),
+            m_stolen.load(std::memory_order_relaxed),
+            m_cancelled.load(std::memory_order_relaxed),
+            m_pending.load(std::memory_order_relaxed),
+            m_max_depth.load(std::memory_order_relaxed),
+    };
+}
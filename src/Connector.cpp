@@ -0,0 +1,257 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "Connector.hpp"
+#include "EventLoop.hpp"
+#include "Channel.hpp"
+#include "Timer.h"
+#include <fastlog/FastLog.h>
+
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cassert>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+
+// une connexion perdue avant ce délai ne remet pas le backoff à zéro : un serveur qui accepte puis ferme aussitôt
+// ne provoque pas de reconnexions en rafale
+#define CONNECTOR_STABLE_MS 5000
+
+Connector::Connector(EventLoop *loop, const sockaddr *addr, socklen_t addr_len)
+        : m_loop(loop), m_addr_len(addr_len),
+          m_retry_timer(std::make_unique<Timer>([this] { connect(); }, loop))
+{
+    assert(addr_len <= sizeof(m_addr));
+    std::memcpy(&m_addr, addr, addr_len);
+}
+
+Connector::~Connector()
+{
+    assert(m_channel == nullptr);
+}
+
+void Connector::set_retry_delay(uint32_t init_ms, uint32_t max_ms)
+{
+    m_init_retry_delay = init_ms;
+    m_max_retry_delay = std::max(init_ms, max_ms);
+    m_retry_delay = init_ms;
+}
+
+void Connector::start()
+{
+    m_loop->assertInLoopThread();
+    m_connect = true;
+    if (m_state == kDisconnected)
+    {
+        connect();
+    }
+}
+
+void Connector::restart()
+{
+    m_loop->assertInLoopThread();
+    m_state = kDisconnected;
+    m_retry_timer->stop();
+    if (m_loop->now_ms() - m_connected_time >= CONNECTOR_STABLE_MS)
+    {
+        m_retry_delay = m_init_retry_delay;
+        start();
+        return;
+    }
+    // connexion trop brève : nouvelle tentative après le délai courant, qui continue de croître
+    m_connect = true;
+    retry(-1);
+}
+
+void Connector::stop()
+{
+    m_loop->assertInLoopThread();
+    m_connect = false;
+    m_retry_timer->stop();
+    if (m_state == kConnecting)
+    {
+        m_state = kDisconnected;
+        ::close(remove_and_reset_channel());
+    }
+}
+
+void Connector::connect()
+{
+    if (!m_connect)
+    {
+        return;
+    }
+
+    const int sock_fd = ::socket(m_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0)
+    {
+        const int local_errno = errno;
+        DEBUG_E("Connector socket() failed: %s", std::strerror(local_errno));
+        retry(-1);
+        return;
+    }
+
+    const int ret = ::connect(sock_fd, (const sockaddr *) &m_addr, m_addr_len);
+    const int local_errno = ret == 0 ? 0 : errno;
+    switch (local_errno)
+    {
+        case 0:
+        case EINPROGRESS:
+        case EINTR:
+        case EISCONN:
+            connecting(sock_fd);
+            break;
+
+        case EAGAIN:
+        case EADDRINUSE:
+        case EADDRNOTAVAIL:
+        case ECONNREFUSED:
+        case ENETUNREACH:
+        case ENOENT: // socket unix pas encore créé par le serveur
+            retry(sock_fd);
+            break;
+
+        default:
+            DEBUG_E("Connector connect() failed, giving up: %s", std::strerror(local_errno));
+            ::close(sock_fd);
+            m_connect = false;
+            break;
+    }
+}
+
+void Connector::connecting(int sock_fd)
+{
+    m_state = kConnecting;
+    assert(m_channel == nullptr);
+    m_channel = std::make_unique<Channel>(m_loop, sock_fd);
+    m_channel->set_write_cb([this] { handle_write(); });
+    m_channel->set_error_cb([this] { handle_error(); });
+    m_channel->set_close_cb([this] { handle_error(); });
+    m_channel->enable_writing();
+}
+
+void Connector::handle_write()
+{
+    if (m_state != kConnecting)
+    {
+        return;
+    }
+
+    const int sock_fd = remove_and_reset_channel();
+    int opt_val = 0;
+    socklen_t opt_len = sizeof opt_val;
+    if (::getsockopt(sock_fd, SOL_SOCKET, SO_ERROR, &opt_val, &opt_len) != 0)
+    {
+        opt_val = errno;
+    }
+
+    if (opt_val != 0)
+    {
+        DEBUG_W("Connector connect error fd %d: %s", sock_fd, std::strerror(opt_val));
+        retry(sock_fd);
+        return;
+    }
+
+    m_state = kConnected;
+    if (m_connect && m_new_connection_cb)
+    {
+        // le délai n'est remis à zéro que si la connexion tient, voir restart()
+        m_connected_time = m_loop->now_ms();
+        m_new_connection_cb(sock_fd);
+    }
+    else
+    {
+        ::close(sock_fd);
+    }
+}
+
+void Connector::handle_error()
+{
+    if (m_state != kConnecting)
+    {
+        return;
+    }
+
+    const int sock_fd = remove_and_reset_channel();
+    int opt_val = 0;
+    socklen_t opt_len = sizeof opt_val;
+    ::getsockopt(sock_fd, SOL_SOCKET, SO_ERROR, &opt_val, &opt_len);
+    DEBUG_W("Connector error fd %d: %s", sock_fd, std::strerror(opt_val));
+    retry(sock_fd);
+}
+
+void Connector::retry(int sock_fd)
+{
+    if (sock_fd >= 0)
+    {
+        ::close(sock_fd);
+    }
+    m_state = kDisconnected;
+    if (!m_connect)
+    {
+        return;
+    }
+
+    DEBUG_D("Connector retry in %u ms", m_retry_delay);
+    m_retry_timer->stop();
+    m_retry_timer->set_timeout(m_retry_delay, false);
+    m_retry_timer->start();
+    m_retry_delay = std::min(m_retry_delay * 2, m_max_retry_delay);
+}
+
+int Connector::remove_and_reset_channel()
+{
+    m_channel->disable_all();
+    m_loop->remove_channel(m_channel.get());
+    const int sock_fd = m_channel->fd();
+    // On est peut-être dans Channel::on_events : le channel est détruit plus tard, dans la file de la boucle
+    std::shared_ptr<Channel> channel(m_channel.release());
+    m_loop->queue([channel] {});
+    return sock_fd;
+}
+
+socklen_t Connector::make_inet_address(const std::string &ip, uint16_t port, sockaddr_storage *addr)
+{
+    std::memset(addr, 0, sizeof(*addr));
+    auto *in4 = (sockaddr_in *) addr;
+    if (inet_pton(AF_INET, ip.c_str(), &in4->sin_addr) == 1)
+    {
+        in4->sin_family = AF_INET;
+        in4->sin_port = htons(port);
+        return sizeof(sockaddr_in);
+    }
+
+    auto *in6 = (sockaddr_in6 *) addr;
+    if (inet_pton(AF_INET6, ip.c_str(), &in6->sin6_addr) == 1)
+    {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        return sizeof(sockaddr_in6);
+    }
+    return 0;
+}
+
+socklen_t Connector::make_unix_address(const std::string &path, sockaddr_storage *addr)
+{
+    std::memset(addr, 0, sizeof(*addr));
+    auto *un = (sockaddr_un *) addr;
+    if (path.empty() || path.size() >= sizeof(un->sun_path))
+    {
+        return 0;
+    }
+
+    un->sun_family = AF_UNIX;
+    std::memcpy(un->sun_path, path.data(), path.size());
+    const bool abstract = path[0] == '@';
+    if (abstract)
+    {
+        un->sun_path[0] = '\0';
+    }
+    return (socklen_t) (offsetof(sockaddr_un, sun_path) + path.size() + (abstract ? 0 : 1));
+}
@@ -0,0 +1,277 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "Coroutine.hpp"
+#include "CoroutineState.h"
+#include "TcpConnection.hpp"
+#include "Timer.h"
+#include "buffer/ProtoBuffer.h"
+
+#include <cassert>
+#include <exception>
+#include <new>
+#include <utility>
+
+#define CO_FRAME_GRANULARITY 64
+#define CO_FRAME_CLASSES 32 // frames jusqu'à 2 KiB
+#define CO_FRAME_MAX_CACHED 256
+
+namespace {
+    struct FreeFrame {
+        FreeFrame *next;
+    };
+
+    struct FrameCache {
+        FreeFrame *lists[CO_FRAME_CLASSES]{};
+        uint32_t counts[CO_FRAME_CLASSES]{};
+
+        ~FrameCache()
+        {
+            for (auto &list: lists) {
+                while (list != nullptr) {
+                    FreeFrame *next = list->next;
+                    ::operator delete(list);
+                    list = next;
+                }
+            }
+        }
+    };
+
+    // un cache par thread, donc par boucle : aucune synchronisation
+    thread_local FrameCache t_frame_cache;
+}
+
+void *CoFrameAllocator::allocate(size_t size)
+{
+    const size_t size_class = (size + CO_FRAME_GRANULARITY - 1) / CO_FRAME_GRANULARITY;
+    if (size_class == 0 || size_class > CO_FRAME_CLASSES) {
+        return ::operator new(size);
+    }
+
+    FreeFrame *&list = t_frame_cache.lists[size_class - 1];
+    if (list != nullptr) {
+        FreeFrame *frame = list;
+        list = frame->next;
+        --t_frame_cache.counts[size_class - 1];
+        return frame;
+    }
+    return ::operator new(size_class * CO_FRAME_GRANULARITY);
+}
+
+void CoFrameAllocator::deallocate(void *ptr, size_t size)
+{
+    const size_t size_class = (size + CO_FRAME_GRANULARITY - 1) / CO_FRAME_GRANULARITY;
+    if (size_class == 0 || size_class > CO_FRAME_CLASSES || t_frame_cache.counts[size_class - 1] >= CO_FRAME_MAX_CACHED) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    auto *frame = static_cast<FreeFrame *>(ptr);
+    frame->next = t_frame_cache.lists[size_class - 1];
+    t_frame_cache.lists[size_class - 1] = frame;
+    ++t_frame_cache.counts[size_class - 1];
+}
+
+void ConnTask::promise_type::unhandled_exception() noexcept
+{
+    try {
+        std::rethrow_exception(std::current_exception());
+    } catch (const std::exception &e) {
+        DEBUG_E("Connection coroutine terminated by exception: %s", e.what());
+    } catch (...) {
+        DEBUG_E("Connection coroutine terminated by unknown exception");
+    }
+}
+
+ReadAwaiter::ReadAwaiter(TcpConnection *conn, uint32_t exactly, std::string_view delimiter)
+        : m_conn(conn), m_exactly(exactly), m_delimiter(delimiter)
+{
+}
+
+bool ReadAwaiter::try_complete()
+{
+    CoroutineState *co = m_conn->co_state();
+    if (m_delimiter.empty()) {
+        if (co->input.size() < m_exactly) {
+            return false;
+        }
+        co->consumed = m_exactly;
+    } else {
+        const size_t pos = co->input.find(m_delimiter);
+        if (pos == std::string::npos) {
+            return false;
+        }
+        co->consumed = pos + m_delimiter.size();
+    }
+    m_result = std::string_view(co->input.data(), co->consumed);
+    return true;
+}
+
+bool ReadAwaiter::await_ready()
+{
+    m_conn->event_loop()->assertInLoopThread();
+    CoroutineState *co = m_conn->co_state();
+    // la vue rendue par la lecture précédente n'est plus valide
+    co->input.erase(0, co->consumed);
+    co->consumed = 0;
+    if (try_complete() || !m_conn->is_connected()) {
+        m_conn->co_update_flow();
+        return true;
+    }
+    return false;
+}
+
+void ReadAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    CoroutineState *co = m_conn->co_state();
+    assert(co->reader == nullptr);
+    co->reader = this;
+    co->reader_handle = handle;
+    // la coroutine attend des données : la lecture reprend même au-dessus du seuil
+    m_conn->co_update_flow();
+}
+
+bool WriteAwaiter::await_ready()
+{
+    m_conn->event_loop()->assertInLoopThread();
+    if (!m_conn->is_connected()) {
+        m_buffer->reuse();
+        return true;
+    }
+    m_conn->write_buffer_internal(m_buffer);
+    m_result = true;
+    return !m_conn->has_pending_output();
+}
+
+void WriteAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    CoroutineState *co = m_conn->co_state();
+    assert(!co->writer_handle);
+    co->writer = this;
+    co->writer_handle = handle;
+}
+
+SleepAwaiter::SleepAwaiter(TcpConnection *conn, uint32_t ms) : m_conn(conn), m_ms(ms)
+{
+}
+
+SleepAwaiter::~SleepAwaiter() = default;
+
+bool SleepAwaiter::await_ready() const
+{
+    m_conn->event_loop()->assertInLoopThread();
+    return m_ms == 0 || !m_conn->is_connected();
+}
+
+void SleepAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    CoroutineState *co = m_conn->co_state();
+    assert(!co->sleeper_handle);
+    co->sleeper_handle = handle;
+    // pas de reprise dans call_events : la suite de la coroutine peut fermer la connexion ou détruire d'autres Timer
+    // déjà expirés, et détruirait ce Timer dans son propre callback. Il vit jusqu'à la reprise, et la tâche garde la
+    // connexion (la coroutine a pu être reprise par la fermeture entre-temps)
+    EventLoop *loop = m_conn->event_loop();
+    m_timer = std::make_unique<Timer>([this, loop] {
+        loop->queue_next_iteration([conn = m_conn->shared_from_this()] { conn->co_on_slept(); });
+    }, loop);
+    m_timer->set_timeout(m_ms, false);
+    m_timer->start();
+}
+
+ReadAwaiter TcpConnection::read_exactly(uint32_t n)
+{
+    co_state();
+    return {this, n, {}};
+}
+
+ReadAwaiter TcpConnection::read_until(std::string_view delimiter)
+{
+    co_state();
+    return {this, 0, delimiter};
+}
+
+WriteAwaiter TcpConnection::write(ProtoBuffer *buffer)
+{
+    co_state();
+    return {this, buffer};
+}
+
+SleepAwaiter TcpConnection::sleep(uint32_t ms)
+{
+    co_state();
+    return {this, ms};
+}
+
+CoroutineState *TcpConnection::co_state()
+{
+    if (m_co == nullptr) {
+        m_co = std::make_unique<CoroutineState>();
+    }
+    return m_co.get();
+}
+
+void TcpConnection::set_co_input_high_water(size_t bytes)
+{
+    m_loop->assertInLoopThread();
+    co_state()->high_water = bytes;
+    co_update_flow();
+}
+
+void TcpConnection::co_on_data(const uint8_t *data, uint32_t length)
+{
+    m_co->input.append((const char *) data, length);
+    if (m_co->reader != nullptr && m_co->reader->try_complete()) {
+        m_co->reader = nullptr;
+        std::exchange(m_co->reader_handle, nullptr).resume();
+    }
+    co_update_flow();
+}
+
+void TcpConnection::co_update_flow()
+{
+    if (m_state != kConnected) {
+        return;
+    }
+    const bool full = m_co->input.size() - m_co->consumed >= m_co->high_water;
+    if (full && m_co->reader == nullptr) {
+        pause_reading_internal(kPauseCoroutine);
+    } else {
+        resume_reading_internal(kPauseCoroutine);
+    }
+}
+
+void TcpConnection::co_on_drained()
+{
+    if (m_co->writer_handle) {
+        m_co->writer = nullptr;
+        std::exchange(m_co->writer_handle, nullptr).resume();
+    }
+}
+
+void TcpConnection::co_on_slept()
+{
+    if (m_co->sleeper_handle) {
+        std::exchange(m_co->sleeper_handle, nullptr).resume();
+    }
+}
+
+void TcpConnection::co_on_closed()
+{
+    if (m_co->reader != nullptr) {
+        m_co->reader = nullptr;
+        std::exchange(m_co->reader_handle, nullptr).resume();
+    }
+    if (m_co->writer_handle) {
+        // ce qui restait en file ne partira pas
+        std::exchange(m_co->writer, nullptr)->m_result = false;
+        std::exchange(m_co->writer_handle, nullptr).resume();
+    }
+    if (m_co->sleeper_handle) {
+        // le Timer est détruit avec l'attente ; s'il a déjà expiré, co_on_slept ne trouvera plus rien
+        std::exchange(m_co->sleeper_handle, nullptr).resume();
+    }
+}
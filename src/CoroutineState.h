@@ -0,0 +1,47 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#ifndef TKS_COROUTINE_STATE_H
+#define TKS_COROUTINE_STATE_H
+
+#include <coroutine>
+#include <string>
+#include <utility>
+
+class ReadAwaiter;
+class WriteAwaiter;
+
+// état coroutine d'une TcpConnection, créé à la première attente
+struct CoroutineState
+{
+    std::string input;       // octets reçus pas encore rendus à la coroutine
+    size_t consumed{0};      // octets rendus par la lecture précédente, retirés à la suivante
+    size_t high_water{1 << 20}; // voir TcpConnection::set_co_input_high_water
+    ReadAwaiter *reader{nullptr};
+    std::coroutine_handle<> reader_handle;
+    WriteAwaiter *writer{nullptr};
+    std::coroutine_handle<> writer_handle;
+    std::coroutine_handle<> sleeper_handle;
+
+    // connexion détruite sans passer par handle_close (arrêt du serveur...) : la coroutine suspendue ne sera jamais
+    // reprise, sa frame est libérée ici. Seulement si elle ne garde pas la connexion vivante (voir Coroutine.hpp)
+    ~CoroutineState()
+    {
+        reader = nullptr;
+        writer = nullptr;
+        if (reader_handle) {
+            std::exchange(reader_handle, nullptr).destroy();
+        }
+        if (writer_handle) {
+            std::exchange(writer_handle, nullptr).destroy();
+        }
+        if (sleeper_handle) {
+            std::exchange(sleeper_handle, nullptr).destroy();
+        }
+    }
+};
+
+#endif //TKS_COROUTINE_STATE_H
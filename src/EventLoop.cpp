@@ -10,8 +10,11 @@
 #include "AsyncWaker.hpp"
 #include "buffer/ProtoBuffer.h"
 #include "EventObject.h"
+#include "MirroredRing.hpp"
+#include "TcpConnection.hpp"
 #include "timeutils/TimeUtils.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <cassert>
 
@@ -25,6 +28,7 @@ EventLoop::EventLoop() : m_looping(false), m_thread_id(std::this_thread::get_id(
                          m_calling_pending_queue(false), m_async_waker(std::make_unique<AsyncWaker>(this))
 {
     DEBUG_D("EventLoop created");
+    update_clock();
 
     if (t_loopInThisThread) {
         DEBUG_F("Another EventLoop exists in this thread");
@@ -39,31 +43,71 @@ void EventLoop::loop() {
     assertInLoopThread();
 
     m_looping = true;
+    m_native_thread = pthread_self();
 
     std::vector<Channel *> channels{};
+    std::vector<std::function<void()>> deferred{};
+    int64_t woke_ns = 0;
 
     while (!m_quit.load()) {
         try {
             channels.clear();
+            deferred.clear();
 
             // Ici epoll est en polling, il est bloqué, si vous souhaitez rappeler des événements actifs, vous devez trouver un moyen de le réveiller
             // on utilise ici une méthode très astucieuse, en particulier en utilisant un descripteur de fichier pour se réveiller
 
-            const int64_t time = m_event_manager->epoll(call_events(TimeUtils::current_time_in_millis()), &channels);
-
+            m_activity.store(kActivityTimers, std::memory_order_relaxed);
+            // relue avant de calculer l'attente : les callbacks de l'itération ont pu prendre du temps
+            update_clock();
+            if (woke_ns != 0) {
+                m_busy_ns.store(m_busy_ns.load(std::memory_order_relaxed) + (uint64_t) (now() - woke_ns), std::memory_order_relaxed);
+            }
+            int timeout = call_events(now_ms());
+
+            m_polling.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // ce qui a été reporté pendant l'itération précédente ; ce qui le sera pendant celle-ci attend la suivante
+            deferred.swap(m_next_iteration);
+            if (!deferred.empty() || has_inbox_items()) {
+                timeout = 0;
+            }
+            m_busy_since_ms.store(0, std::memory_order_relaxed);
+            m_activity.store(kActivityIdle, std::memory_order_relaxed);
+            m_event_manager->epoll(timeout, &channels);
+            m_polling.store(false, std::memory_order_relaxed);
+            update_clock();
+            woke_ns = now();
+            const int64_t time = now_ms();
+            // release : le watchdog qui lit une valeur non nulle voit aussi m_native_thread
+            m_busy_since_ms.store(now() / 1000000, std::memory_order_release);
+            m_heartbeat.store(m_heartbeat.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+            m_activity.store(kActivityTimers, std::memory_order_relaxed);
             call_events(time);
 
             for (auto const &it: channels) {
+                m_activity.store(it->fd(), std::memory_order_relaxed);
                 it->on_events(time);
             }
 
+            m_activity.store(kActivityDeferred, std::memory_order_relaxed);
+            for (auto const &functor: deferred) {
+                functor();
+            }
+
+            m_activity.store(kActivityPendingQueue, std::memory_order_relaxed);
             do_pending_queue();
-            m_event_manager->check_periodic_observers();
+            m_activity.store(kActivityInboxes, std::memory_order_relaxed);
+            drain_inboxes();
+            m_activity.store(kActivityPeriodic, std::memory_order_relaxed);
+            m_event_manager->check_periodic_observers(time);
         }
         catch (const std::exception &e) {
             std::cerr << e.what() << '\n';
         }
     }
+    m_busy_since_ms.store(0, std::memory_order_relaxed);
     m_looping = false;
 }
 
@@ -82,6 +126,12 @@ void EventLoop::remove_channel(Channel *channel) {
     m_event_manager->remove_channel(channel);
 }
 
+void EventLoop::register_channel(Channel *channel) {
+    assert(channel->owner_loop() == this);
+    assertInLoopThread();
+    m_event_manager->register_channel(channel);
+}
+
 void EventLoop::quit() {
     m_quit.store(true);
     if (!isInLoopThread()) {
@@ -120,6 +170,11 @@ void EventLoop::queue(std::function<void()> const &to_run) {
     }
 }
 
+void EventLoop::queue_next_iteration(std::function<void()> const &to_run) {
+    assertInLoopThread();
+    m_next_iteration.push_back(to_run);
+}
+
 void EventLoop::do_pending_queue() {
     std::vector<std::function<void()>> functors;
     m_calling_pending_queue.store(true);
@@ -136,15 +191,141 @@ void EventLoop::do_pending_queue() {
     m_calling_pending_queue.store(false);
 }
 
+EventLoop *EventLoop::current() {
+    return t_loopInThisThread;
+}
+
+void EventLoop::attach_inbox(LoopMailbox *inbox) {
+    assertInLoopThread();
+    m_inboxes.push_back(inbox);
+}
+
+void EventLoop::notify_inbox() {
+    // pairé avec la barrière de loop() : soit la boucle voit l'élément avant epoll_wait, soit on voit m_polling
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_polling.load(std::memory_order_relaxed) && m_polling.exchange(false)) {
+        m_async_waker->wakeup();
+    }
+}
+
+bool EventLoop::has_inbox_items() {
+    for (auto *inbox: m_inboxes) {
+        if (!inbox->empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EventLoop::drain_inboxes() {
+    bool drained = false;
+    for (auto *inbox: m_inboxes) {
+        // au plus une capacité par itération : un producteur rapide ne bloque pas la boucle indéfiniment
+        drained |= inbox->drain([](std::function<void()> &task) { task(); }, inbox->capacity()) != 0;
+    }
+    return drained;
+}
+
 ProtoBuffer *EventLoop::network_buffer() {
     if (m_network_buffer == nullptr) {
-        m_network_buffer = new ProtoBuffer((uint32_t) READ_BUFFER_SIZE);
+        m_network_buffer = new ProtoBuffer(m_read_buffer_size);
     }
     return m_network_buffer;
 }
 
+ProtoBuffer *EventLoop::send_buffer() {
+    if (m_send_buffer == nullptr) {
+        m_send_buffer = new ProtoBuffer(m_write_buffer_size);
+    }
+    return m_send_buffer;
+}
+
+RingPool *EventLoop::ring_pool() {
+    assertInLoopThread();
+    if (m_ring_pool == nullptr) {
+        m_ring_pool = std::make_unique<RingPool>();
+    }
+    return m_ring_pool.get();
+}
+
+void EventLoop::set_read_sizes(uint32_t read_min, uint32_t read_initial, uint32_t read_max) {
+    assert(m_network_buffer == nullptr);
+    assert(read_min > 0 && read_min <= read_initial && read_initial <= read_max);
+    m_read_size_min = read_min;
+    m_read_size_initial = read_initial;
+    m_read_buffer_size = read_max;
+}
+
+LatencyStats *EventLoop::enable_latency_stats() {
+    assertInLoopThread();
+    LatencyStats *stats = m_latency_stats.load(std::memory_order_relaxed);
+    if (stats == nullptr) {
+        stats = new LatencyStats();
+        m_latency_stats.store(stats, std::memory_order_release);
+    }
+    return stats;
+}
+
+void EventLoop::set_traffic_sampling(bool sampling) {
+    assertInLoopThread();
+    m_traffic_sampling = sampling;
+    if (!sampling) {
+        m_traffic.clear();
+        m_traffic_bytes = 0;
+    }
+}
+
+void EventLoop::record_traffic(TcpConnection *conn, uint64_t bytes) {
+    TrafficSample &sample = m_traffic[conn->conn_id()];
+    if (sample.bytes == 0) {
+        // une fois par connexion et par fenêtre
+        sample.conn = conn->weak_from_this();
+    }
+    sample.bytes += bytes;
+    m_traffic_bytes += bytes;
+}
+
+TrafficWindow EventLoop::take_traffic(size_t top_count) {
+    assertInLoopThread();
+    TrafficWindow window;
+    window.total_bytes = m_traffic_bytes;
+    if (top_count > 0) {
+        window.top.reserve(m_traffic.size());
+        for (auto &item: m_traffic) {
+            window.top.push_back(std::move(item.second));
+        }
+        const size_t count = std::min(top_count, window.top.size());
+        std::partial_sort(window.top.begin(), window.top.begin() + (long) count, window.top.end(),
+                          [](TrafficSample const &a, TrafficSample const &b) { return a.bytes > b.bytes; });
+        window.top.resize(count);
+    }
+    m_traffic.clear();
+    m_traffic_bytes = 0;
+    return window;
+}
+
+void EventLoop::set_write_buffer_size(uint32_t size) {
+    assert(m_send_buffer == nullptr && size > 0);
+    m_write_buffer_size = size;
+}
+
+// Un seul appel vDSO par lecture ; TimeUtils n'est consulté qu'une fois par seconde pour garder now_ms() dans sa base
+// (un saut de l'horloge murale y est donc reporté au plus une seconde plus tard).
+void EventLoop::update_clock() {
+    const int64_t now_ns = latency_clock_ns(CLOCK_MONOTONIC);
+    m_now_ns.store(now_ns, std::memory_order_relaxed);
+    if (now_ns >= m_next_calibration_ns) {
+        m_wall_offset_ms.store(TimeUtils::current_time_in_millis() - now_ns / 1000000, std::memory_order_relaxed);
+        m_next_calibration_ns = now_ns + 1000000000;
+    }
+}
+
+uint64_t EventLoop::epoll_ctl_calls() const {
+    return m_event_manager->epoll_ctl_calls();
+}
+
 void EventLoop::schedule_event(EventObject *eventObject, uint32_t time) {
-    eventObject->time(TimeUtils::current_time_in_millis() + time);
+    eventObject->time(now_ms() + time);
     std::list<EventObject *>::iterator iter;
     for (iter = m_events.begin(); iter != m_events.end(); iter++) {
         if ((*iter)->time() > eventObject->time()) {
@@ -193,6 +374,11 @@ EventLoop::~EventLoop() {
         delete m_network_buffer;
         m_network_buffer = nullptr;
     }
+    if (m_send_buffer != nullptr) {
+        delete m_send_buffer;
+        m_send_buffer = nullptr;
+    }
+    delete m_latency_stats.load();
 }
 
 void EventLoop::wakeup() const
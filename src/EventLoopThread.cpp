@@ -16,8 +16,9 @@ EventLoopThread::~EventLoopThread()
     m_thread.join();
 }
 
-EventLoop *EventLoopThread::startLoop()
+EventLoop *EventLoopThread::startLoop(int pool_index)
 {
+    m_pool_index = pool_index;
     m_thread = std::thread([this] { threadFunc(); });
 
     {
@@ -31,6 +32,8 @@ EventLoop *EventLoopThread::startLoop()
 void EventLoopThread::threadFunc()
 {
     EventLoop loop{};
+    // avant la publication de la boucle : lu ensuite sans synchronisation depuis d'autres threads
+    loop.pool_index(m_pool_index);
 
     {
         std::unique_lock<std::mutex> lock(m_mutex);
@@ -27,8 +27,63 @@ void EventLoopThreadPool::start()
     {
         auto *t = new EventLoopThread;
         m_threads.emplace_back(t);
-        m_loops.push_back(t->startLoop());
+        m_loops.push_back(t->startLoop((int) i));
     }
+
+    const size_t n = m_loops.size();
+    m_mailboxes.resize(n * n);
+    for (size_t from = 0; from < n; ++from)
+    {
+        for (size_t to = 0; to < n; ++to)
+        {
+            if (from != to)
+            {
+                m_mailboxes[from * n + to] = std::make_unique<LoopMailbox>(m_mailbox_capacity);
+            }
+        }
+    }
+
+    for (size_t to = 0; to < n; ++to)
+    {
+        std::vector<LoopMailbox *> inboxes;
+        for (size_t from = 0; from < n; ++from)
+        {
+            if (from != to)
+            {
+                inboxes.push_back(m_mailboxes[from * n + to].get());
+            }
+        }
+        EventLoop *loop = m_loops[to];
+        loop->run([loop, inboxes]
+        {
+            for (auto *inbox: inboxes)
+            {
+                loop->attach_inbox(inbox);
+            }
+        });
+    }
+}
+
+bool EventLoopThreadPool::send(EventLoop *to, std::function<void()> task)
+{
+    EventLoop *from = EventLoop::current();
+    const int from_index = from == nullptr ? -1 : from->pool_index();
+    const int to_index = to->pool_index();
+    // les index se recouvrent d'un pool à l'autre : les deux boucles doivent appartenir à celui-ci
+    if (from_index < 0 || to_index < 0 || from == to || (size_t) from_index >= m_loops.size() || m_loops[from_index] != from ||
+        (size_t) to_index >= m_loops.size() || m_loops[to_index] != to)
+    {
+        to->queue(task);
+        return true;
+    }
+
+    auto &mailbox = m_mailboxes[from_index * m_loops.size() + to_index];
+    if (!mailbox->push(std::move(task)))
+    {
+        return false;
+    }
+    to->notify_inbox();
+    return true;
 }
 
 EventLoop *EventLoopThreadPool::get_next_loop()
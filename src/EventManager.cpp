@@ -7,13 +7,13 @@
 #include "EventManager.hpp"
 #include "Channel.hpp"
 #include "EventLoop.hpp"
-#include "timeutils/TimeUtils.hpp"
 #include "fastlog/FastLog.h"
 
 #include <cassert>
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <memory.h>
+#include <algorithm>
 
 #define INIT_EVENTS_SIZE 16
 #define MAX_EVENTS_SIZE 4096
@@ -28,20 +28,17 @@ EventManager::EventManager(EventLoop *owner) : m_owner_loop(owner), m_epoll_fd(e
 
 EventManager::~EventManager() { ::close(m_epoll_fd); }
 
-int64_t EventManager::epoll(int timeout_ms, std::vector<Channel *> *channels) {
+void EventManager::epoll(int timeout_ms, std::vector<Channel *> *channels) {
+    flush_updates();
     auto max_events = (int32_t) m_event_list.size();
     int32_t num_events = ::epoll_wait(m_epoll_fd, m_event_list.data(), max_events, timeout_ms);
-    int64_t now = TimeUtils::current_time_in_millis();
     if (num_events > 0) {
         DEBUG_D("%d events happened", num_events);
 
         for (int i = 0; i < num_events; ++i) {
-            auto it = m_channels.find(m_event_list[i].data.fd);
-            if (it == m_channels.end())
-            {
-                continue;
-            }
-            Channel *channel = it->second;
+            // le Channel est enregistré dans l'événement : pas de table par fd, dimensionnée sur le plus grand fd du
+            // processus, dans chaque boucle
+            auto *channel = static_cast<Channel *>(m_event_list[i].data.ptr);
             channel->set_revents(m_event_list[i].events);
             channels->push_back(channel);
         }
@@ -57,18 +54,16 @@ int64_t EventManager::epoll(int timeout_ms, std::vector<Channel *> *channels) {
     } else if(num_events == -1){
         DEBUG_F("Epoll wait FAILED %s", strerror(errno));
     }
-
-    return now;
 }
 
-void EventManager::check_periodic_observers() {
+void EventManager::check_periodic_observers(const int64_t now) {
     if (m_periodic_notification_observers.empty()) {
         return;
     }
 
-    auto now = TimeUtils::current_time_in_millis();
-    for (auto const &item: m_periodic_notification_observers) {
-        item.second->on_periodic_notification(now);
+    // par index : un callback peut ajouter un observateur pendant le parcours
+    for (size_t i = 0; i < m_periodic_notification_observers.size(); ++i) {
+        m_periodic_notification_observers[i]->on_periodic_notification(now);
     }
 }
 
@@ -78,26 +73,15 @@ void EventManager::updateChannel(Channel *channel) {
     const ChannelMark mark = channel->mark();
 
     if (mark == ChannelMark::NEW || mark == ChannelMark::DELETED) {
-        int fd = channel->fd();
-
         //add new fd with EPOLL_CTL_ADD
         if (mark == ChannelMark::NEW) {
-            assert(m_channels.find(fd) == m_channels.end());
-            m_channels[fd] = channel;
-            // pn
-            if (channel->supports_pn()) {
-                assert(m_periodic_notification_observers.find(fd) == m_periodic_notification_observers.end());
-                m_periodic_notification_observers[fd] = channel;
-            }
+            add_channel(channel);
         } else // index == kDeleted
         {
-            assert(m_channels.find(fd) != m_channels.end());
-            assert(m_channels[fd] == channel);
-
             // pn
             if (channel->supports_pn()) {
-                assert(m_periodic_notification_observers.find(fd) != m_periodic_notification_observers.end());
-                assert(m_periodic_notification_observers[fd] == channel);
+                assert(channel->pn_index() >= 0);
+                assert(m_periodic_notification_observers[channel->pn_index()] == channel);
             }
         }
 
@@ -105,38 +89,85 @@ void EventManager::updateChannel(Channel *channel) {
         apply_ops(EPOLL_CTL_ADD, channel);
     } else {
         //EPOLL_CTL_MOD/DEL update current fd
-        int fd = channel->fd();
-        (void) fd;
-        assert(m_channels.find(fd) != m_channels.end());
-        assert(m_channels[fd] == channel);
         assert(mark == ChannelMark::ADDED);
         if (channel->is_none_events()) {
+            // immédiat : le fd peut être fermé et réutilisé avant la fin de l'itération
+            drop_pending_update(channel);
             apply_ops(EPOLL_CTL_DEL, channel);
             channel->mark(ChannelMark::DELETED);
+        } else if (!channel->update_pending()) {
+            // epoll_wait n'est appelé qu'à la fin de l'itération : le MOD peut attendre jusque-là
+            channel->update_pending(true);
+            m_pending_updates.push_back(channel);
+        }
+    }
+}
+
+void EventManager::register_channel(Channel *channel) {
+    m_owner_loop->assertInLoopThread();
+    assert(channel->mark() == ChannelMark::NEW && channel->is_none_events());
+    add_channel(channel);
+    // connu de la boucle mais absent de l'epoll, comme après un disable_all
+    channel->mark(ChannelMark::DELETED);
+}
+
+void EventManager::add_channel(Channel *channel) {
+    assert(channel->owner_loop() == m_owner_loop);
+    // pn
+    if (channel->supports_pn()) {
+        assert(channel->pn_index() < 0);
+        channel->pn_index((int32_t) m_periodic_notification_observers.size());
+        m_periodic_notification_observers.push_back(channel);
+    }
+}
+
+void EventManager::flush_updates() {
+    // par index : pas d'ajout possible pendant le parcours, mais la liste est réutilisée d'une itération à l'autre
+    for (size_t i = 0; i < m_pending_updates.size(); ++i) {
+        Channel *channel = m_pending_updates[i];
+        channel->update_pending(false);
+        // même masque qu'enregistré : le MOD reste nécessaire, en edge-triggered c'est lui qui réarme un EPOLLOUT
+        // déjà consommé (disable_write puis enable_writing dans la même itération)
+        if (channel->exclusive_wakeup()) {
+            // EPOLL_CTL_MOD est refusé (EINVAL) sur une inscription EPOLLEXCLUSIVE
+            apply_ops(EPOLL_CTL_DEL, channel);
+            apply_ops(EPOLL_CTL_ADD, channel);
         } else {
             apply_ops(EPOLL_CTL_MOD, channel);
         }
     }
+    m_pending_updates.clear();
+}
+
+void EventManager::drop_pending_update(Channel *channel) {
+    if (!channel->update_pending()) {
+        return;
+    }
+    channel->update_pending(false);
+    // rare (MOD puis DEL dans la même itération) et la liste est courte
+    auto it = std::find(m_pending_updates.begin(), m_pending_updates.end(), channel);
+    assert(it != m_pending_updates.end());
+    *it = m_pending_updates.back();
+    m_pending_updates.pop_back();
 }
 
 void EventManager::remove_channel(Channel *channel) {
     m_owner_loop->assertInLoopThread();
-    int fd = channel->fd();
-
-    assert(m_channels.find(fd) != m_channels.end());
-    assert(m_channels[fd] == channel);
     assert(channel->is_none_events());
 
     ChannelMark mark = channel->mark();
     assert(mark == ChannelMark::ADDED || mark == ChannelMark::DELETED);
-    size_t n = m_channels.erase(fd);
-    (void) n;
-    assert(n == 1);
+    drop_pending_update(channel);
 
     if (channel->supports_pn()) {
-        n = m_periodic_notification_observers.erase(fd);
-        (void) n;
-        assert(n == 1);
+        // retrait en O(1) : le dernier observateur prend la place du canal retiré
+        const int32_t index = channel->pn_index();
+        assert(index >= 0 && m_periodic_notification_observers[index] == channel);
+        Channel *last = m_periodic_notification_observers.back();
+        m_periodic_notification_observers[index] = last;
+        last->pn_index(index);
+        m_periodic_notification_observers.pop_back();
+        channel->pn_index(-1);
     }
 
     if (mark == ChannelMark::ADDED) {
@@ -145,16 +176,21 @@ void EventManager::remove_channel(Channel *channel) {
     channel->mark(ChannelMark::DELETED);
 }
 
-void EventManager::apply_ops(int operation, Channel *channel) const {
+void EventManager::apply_ops(int operation, Channel *channel) {
     assert(operation == EPOLL_CTL_ADD || operation == EPOLL_CTL_MOD || operation == EPOLL_CTL_DEL);
     struct epoll_event ev{};
     ::memset(&ev, 0, sizeof(ev));
     ev.events = channel->events() | EPOLLET;
-    ev.data.fd = channel->fd();
+    if (channel->exclusive_wakeup()) {
+        // EPOLLEXCLUSIVE n'accepte que EPOLLIN/EPOLLOUT (plus ERR/HUP, toujours signalés)
+        ev.events = (channel->events() & (EPOLLIN | EPOLLOUT)) | EPOLLET | (operation == EPOLL_CTL_ADD ? (uint32_t) EPOLLEXCLUSIVE : 0u);
+    }
+    ev.data.ptr = channel;
     int fd = channel->fd();
 
     DEBUG_D("Epoll ctl op %d, fd %d. events %d", operation, fd, channel->events());
 
+    m_epoll_ctl_calls.store(m_epoll_ctl_calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
     if (::epoll_ctl(m_epoll_fd, operation, fd, &ev) == 0) {
         return;
     }
@@ -0,0 +1,232 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "LoopWatchdog.hpp"
+#include "EventLoop.hpp"
+#include <fastlog/FastLog.h>
+
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <execinfo.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Une seule capture à la fois dans le processus. stack_state = (numéro de capture << 2) | phase : le handler ne
+// répond qu'à la capture en cours, et un handler trop tardif ne peut pas écrire dans le buffer d'une capture suivante.
+#define CAPTURE_FREE 0
+#define CAPTURE_REQUESTED 1
+#define CAPTURE_WRITING 2
+#define CAPTURE_DONE 3
+#define CAPTURE_PHASE_MASK 3
+
+static std::mutex capture_mutex;
+static uint64_t capture_sequence; // sous capture_mutex
+static std::atomic<uint64_t> stack_state{CAPTURE_FREE};
+static std::atomic<pthread_t> stack_target;
+static void *stack_frames[WATCHDOG_MAX_FRAMES];
+static int stack_depth;
+
+// backtrace() n'est pas async-signal-safe. On suppose que l'appel fait dans start() a chargé libgcc et que les
+// suivants se contentent de dérouler la pile ; si le thread a été interrompu dans le chargeur dynamique (dlopen,
+// dl_iterate_phdr), le handler peut rester bloqué : capture() abandonne, et n'en lance plus tant qu'il écrit.
+static void on_capture_signal(int)
+{
+    const int saved_errno = errno;
+    uint64_t requested = stack_state.load(std::memory_order_acquire);
+    if ((requested & CAPTURE_PHASE_MASK) == CAPTURE_REQUESTED && pthread_equal(pthread_self(), stack_target.load(std::memory_order_relaxed)) &&
+        stack_state.compare_exchange_strong(requested, (requested & ~(uint64_t) CAPTURE_PHASE_MASK) | CAPTURE_WRITING, std::memory_order_acq_rel))
+    {
+        stack_depth = backtrace(stack_frames, WATCHDOG_MAX_FRAMES);
+        stack_state.store((requested & ~(uint64_t) CAPTURE_PHASE_MASK) | CAPTURE_DONE, std::memory_order_release);
+    }
+    errno = saved_errno;
+}
+
+LoopWatchdog::LoopWatchdog(uint32_t budget_ms, int signal) : m_budget_ms(budget_ms), m_signal(signal < 0 ? SIGRTMIN + 2 : signal)
+{
+}
+
+LoopWatchdog::~LoopWatchdog()
+{
+    stop();
+}
+
+void LoopWatchdog::watch(EventLoop *loop)
+{
+    std::lock_guard lock(m_mutex);
+    m_loops.push_back(Watched{loop, 0});
+}
+
+void LoopWatchdog::unwatch(EventLoop *loop)
+{
+    std::lock_guard lock(m_mutex);
+    m_loops.erase(std::remove_if(m_loops.begin(), m_loops.end(), [loop](Watched const &w) { return w.loop == loop; }), m_loops.end());
+}
+
+void LoopWatchdog::set_on_stall(std::function<void(StallReport const &)> const &cb)
+{
+    std::lock_guard lock(m_mutex);
+    m_on_stall = cb;
+}
+
+void LoopWatchdog::start()
+{
+    std::lock_guard lock(m_mutex);
+    if (m_running)
+    {
+        return;
+    }
+
+    // le premier appel de backtrace() charge libgcc : à faire ici, pas dans le handler
+    void *warmup[1];
+    backtrace(warmup, 1);
+
+    struct sigaction action{};
+    action.sa_handler = on_capture_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(m_signal, &action, nullptr) != 0)
+    {
+        DEBUG_E("LoopWatchdog: sigaction(%d): %s, stacks will not be captured", m_signal, std::strerror(errno));
+    }
+
+    m_running = true;
+    m_thread = std::thread([this] { run(); });
+}
+
+void LoopWatchdog::stop()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        if (!m_running)
+        {
+            return;
+        }
+        m_running = false;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+}
+
+void LoopWatchdog::run()
+{
+    // vérifier 4 fois par budget : une boucle bloquée est signalée avant 1.25 budget
+    const auto period = std::chrono::milliseconds(std::max<uint32_t>(m_budget_ms / 4, 1));
+
+    // watch() / unwatch() peuvent modifier m_loops pendant les callbacks : ceux-ci sont appelés hors du parcours
+    std::vector<StallReport> reports;
+    std::unique_lock lock(m_mutex);
+    while (m_running)
+    {
+        m_cond.wait_for(lock, period);
+        if (!m_running)
+        {
+            break;
+        }
+
+        const int64_t now = latency_clock_ns(CLOCK_MONOTONIC) / 1000000;
+        for (Watched &watched: m_loops)
+        {
+            EventLoop *loop = watched.loop;
+            const int64_t busy_since = loop->busy_since_ms();
+            const uint64_t heartbeat = loop->heartbeat();
+            if (busy_since == 0 || now - busy_since <= (int64_t) m_budget_ms || heartbeat == watched.reported_heartbeat)
+            {
+                continue;
+            }
+
+            watched.reported_heartbeat = heartbeat;
+            m_stalls.fetch_add(1, std::memory_order_relaxed);
+
+            StallReport &report = reports.emplace_back();
+            report.loop = loop;
+            report.stalled_ms = now - busy_since;
+            report.activity = loop->activity();
+            if (!capture(loop, &report))
+            {
+                report.depth = 0;
+            }
+        }
+        if (reports.empty())
+        {
+            continue;
+        }
+
+        auto cb = m_on_stall;
+        lock.unlock();
+        for (StallReport const &report: reports)
+        {
+            if (cb)
+            {
+                cb(report);
+            }
+            else
+            {
+                default_report(report);
+            }
+        }
+        reports.clear();
+        lock.lock();
+    }
+}
+
+bool LoopWatchdog::capture(EventLoop *loop, StallReport *report) const
+{
+    std::lock_guard lock(capture_mutex);
+    if ((stack_state.load(std::memory_order_acquire) & CAPTURE_PHASE_MASK) == CAPTURE_WRITING)
+    {
+        // le handler d'une capture abandonnée n'a pas fini, le buffer est encore à lui
+        return false;
+    }
+
+    const uint64_t sequence = ++capture_sequence << 2;
+    stack_target.store(loop->native_thread(), std::memory_order_relaxed);
+    stack_state.store(sequence | CAPTURE_REQUESTED, std::memory_order_release);
+    if (pthread_kill(loop->native_thread(), m_signal) != 0)
+    {
+        stack_state.store(CAPTURE_FREE, std::memory_order_release);
+        return false;
+    }
+
+    // le thread bloqué traite le signal dès qu'il reprend la main dans le noyau ou entre deux instructions
+    for (int i = 0; i < 100 && stack_state.load(std::memory_order_acquire) != (sequence | CAPTURE_DONE); ++i)
+    {
+        usleep(1000);
+    }
+
+    // pas encore pris par le handler : il ne le sera plus
+    uint64_t state = sequence | CAPTURE_REQUESTED;
+    if (stack_state.compare_exchange_strong(state, CAPTURE_FREE, std::memory_order_acq_rel))
+    {
+        return false;
+    }
+    if (state != (sequence | CAPTURE_DONE))
+    {
+        // CAPTURE_WRITING : le handler le fera passer à CAPTURE_DONE, la capture suivante repartira de là
+        return false;
+    }
+    report->depth = stack_depth;
+    std::memcpy(report->frames, stack_frames, sizeof(void *) * (size_t) stack_depth);
+    stack_state.store(CAPTURE_FREE, std::memory_order_release);
+    return true;
+}
+
+void LoopWatchdog::default_report(StallReport const &report)
+{
+    if (report.activity >= 0)
+    {
+        DEBUG_E("EventLoop %p stalled for %ld ms in callbacks of fd %d", (void *) report.loop, report.stalled_ms, report.activity);
+    }
+    else
+    {
+        DEBUG_E("EventLoop %p stalled for %ld ms in phase %d", (void *) report.loop, report.stalled_ms, report.activity);
+    }
+    if (report.depth > 0)
+    {
+        backtrace_symbols_fd(report.frames, report.depth, STDERR_FILENO);
+    }
+}
@@ -0,0 +1,114 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "MirroredRing.hpp"
+#include "fastlog/FastLog.h"
+
+#include <cerrno>
+#include <system_error>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// au-delà de 2^31, la puissance de deux supérieure ne tient plus sur 32 bits
+static uint32_t round_capacity(uint32_t capacity)
+{
+    if (capacity > (UINT32_MAX >> 1) + 1)
+    {
+        throw std::system_error(EINVAL, std::generic_category(), "ring capacity above 2^31");
+    }
+    const auto page = (uint32_t) ::sysconf(_SC_PAGESIZE);
+    uint32_t rounded = page;
+    while (rounded < capacity)
+    {
+        rounded <<= 1;
+    }
+    return rounded;
+}
+
+MirroredRing::MirroredRing(uint32_t capacity) : m_base(nullptr), m_capacity(round_capacity(capacity))
+{
+    const int fd = ::memfd_create("tks-ring", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "ring memfd_create");
+    }
+    if (::ftruncate(fd, m_capacity) != 0)
+    {
+        const int local_errno = errno;
+        ::close(fd);
+        throw std::system_error(local_errno, std::generic_category(), "ring ftruncate");
+    }
+
+    // réserve 2 * capacity d'adresses contiguës, puis y projette deux fois le même memfd
+    void *area = ::mmap(nullptr, (size_t) m_capacity * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED)
+    {
+        const int local_errno = errno;
+        ::close(fd);
+        throw std::system_error(local_errno, std::generic_category(), "ring reserve");
+    }
+
+    auto *base = static_cast<uint8_t *>(area);
+    if (::mmap(base, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        ::mmap(base + m_capacity, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        const int local_errno = errno;
+        ::munmap(area, (size_t) m_capacity * 2);
+        ::close(fd);
+        throw std::system_error(local_errno, std::generic_category(), "ring mirror");
+    }
+
+    // les projections gardent la mémoire, le fd ne sert plus
+    ::close(fd);
+    m_base = base;
+}
+
+MirroredRing::~MirroredRing()
+{
+    ::munmap(m_base, (size_t) m_capacity * 2);
+}
+
+int RingPool::size_class(uint32_t capacity)
+{
+    int size_class = 0;
+    uint32_t size = RING_SIZE_CLASS_MIN;
+    // s'arrête après la dernière classe : size déborderait pour les très grandes capacités
+    while (size < capacity && size_class < RING_SIZE_CLASSES)
+    {
+        size <<= 1;
+        ++size_class;
+    }
+    return size_class;
+}
+
+std::unique_ptr<MirroredRing> RingPool::acquire(uint32_t min_capacity)
+{
+    const int index = size_class(min_capacity);
+    if (index < RING_SIZE_CLASSES && !m_free[index].empty())
+    {
+        std::unique_ptr<MirroredRing> ring = std::move(m_free[index].back());
+        m_free[index].pop_back();
+        ++m_reused;
+        return ring;
+    }
+
+    ++m_created;
+    // hors classes : taille exacte, jamais gardé par le pool
+    return std::make_unique<MirroredRing>(index < RING_SIZE_CLASSES ? (uint32_t) (RING_SIZE_CLASS_MIN << index) : min_capacity);
+}
+
+void RingPool::release(std::unique_ptr<MirroredRing> ring)
+{
+    const int index = size_class(ring->capacity());
+    if (index >= RING_SIZE_CLASSES || (uint32_t) (RING_SIZE_CLASS_MIN << index) != ring->capacity() ||
+        m_free[index].size() >= RING_POOL_PER_CLASS)
+    {
+        DEBUG_D("Ring of %u bytes unmapped", ring->capacity());
+        return;
+    }
+    ring->clear();
+    m_free[index].push_back(std::move(ring));
+}
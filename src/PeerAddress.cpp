@@ -0,0 +1,91 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "PeerAddress.hpp"
+
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+
+PeerAddress::PeerAddress(const sockaddr *addr, socklen_t addr_len)
+{
+    if (addr->sa_family == AF_INET && addr_len >= sizeof(sockaddr_in))
+    {
+        std::memcpy(&m_addr.in4, addr, sizeof(sockaddr_in));
+    }
+    else if (addr->sa_family == AF_INET6 && addr_len >= sizeof(sockaddr_in6))
+    {
+        std::memcpy(&m_addr.in6, addr, sizeof(sockaddr_in6));
+    }
+    else
+    {
+        m_addr.sa.sa_family = addr->sa_family == AF_UNIX ? AF_UNIX : AF_UNSPEC;
+    }
+}
+
+uint16_t PeerAddress::port() const
+{
+    switch (m_addr.sa.sa_family)
+    {
+        case AF_INET:
+            return ntohs(m_addr.in4.sin_port);
+        case AF_INET6:
+            return ntohs(m_addr.in6.sin6_port);
+        default:
+            return 0;
+    }
+}
+
+size_t PeerAddress::format_ip(char *buf, size_t len) const
+{
+    const char *res;
+    switch (m_addr.sa.sa_family)
+    {
+        case AF_INET:
+            res = inet_ntop(AF_INET, &m_addr.in4.sin_addr, buf, len);
+            break;
+        case AF_INET6:
+            res = inet_ntop(AF_INET6, &m_addr.in6.sin6_addr, buf, len);
+            break;
+        default:
+        {
+            const int n = std::snprintf(buf, len, "%s", m_addr.sa.sa_family == AF_UNIX ? "unix" : "unknown");
+            return n < 0 || (size_t) n >= len ? 0 : (size_t) n;
+        }
+    }
+    return res == nullptr ? 0 : std::strlen(buf);
+}
+
+size_t PeerAddress::format(char *buf, size_t len) const
+{
+    const int family = m_addr.sa.sa_family;
+    if (family != AF_INET && family != AF_INET6)
+    {
+        return format_ip(buf, len);
+    }
+
+    char ip[INET6_ADDRSTRLEN];
+    if (format_ip(ip, sizeof(ip)) == 0)
+    {
+        return 0;
+    }
+    const int n = family == AF_INET6 ? std::snprintf(buf, len, "[%s]:%u", ip, port()) : std::snprintf(buf, len, "%s:%u", ip, port());
+    return n < 0 || (size_t) n >= len ? 0 : (size_t) n;
+}
+
+std::string PeerAddress::ip() const
+{
+    char buf[INET6_ADDRSTRLEN];
+    const size_t n = format_ip(buf, sizeof(buf));
+    return {buf, n};
+}
+
+std::string PeerAddress::to_string() const
+{
+    char buf[kMaxFormatted];
+    const size_t n = format(buf, sizeof(buf));
+    return {buf, n};
+}
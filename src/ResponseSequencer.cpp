@@ -0,0 +1,35 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "ResponseSequencer.hpp"
+#include "buffer/ProtoBuffer.h"
+
+ResponseSequencer::~ResponseSequencer()
+{
+    for (auto &slot: m_slots)
+    {
+        if (slot.response != nullptr)
+        {
+            slot.response->reuse();
+        }
+    }
+}
+
+bool ResponseSequencer::complete(uint64_t slot, ProtoBuffer *response)
+{
+    if (slot < m_next_flush || slot >= m_next_slot)
+    {
+        return false;
+    }
+    Slot &entry = m_slots[slot - m_next_flush];
+    if (entry.done)
+    {
+        return false;
+    }
+    entry.response = response;
+    entry.done = true;
+    return true;
+}
@@ -0,0 +1,25 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "SharedPayload.hpp"
+#include "buffer/ProtoBuffer.h"
+
+#include <cstring>
+
+SharedPayload::SharedPayload(const uint8_t *data, uint32_t size) : m_bytes(new uint8_t[size]), m_size(size)
+{
+    std::memcpy(m_bytes.get(), data, size);
+}
+
+std::shared_ptr<const SharedPayload> SharedPayload::create(ProtoBuffer *buffer)
+{
+    return std::make_shared<const SharedPayload>(buffer->bytes() + buffer->position(), buffer->remaining());
+}
+
+std::shared_ptr<const SharedPayload> SharedPayload::create(const uint8_t *data, uint32_t size)
+{
+    return std::make_shared<const SharedPayload>(data, size);
+}
@@ -0,0 +1,155 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "TcpClient.hpp"
+#include "Connector.hpp"
+#include "EventLoop.hpp"
+#include "TcpConnection.hpp"
+#include <fastlog/FastLog.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <system_error>
+#include <utility>
+
+TcpClient::TcpClient(EventLoop *loop, const std::string &ip, uint16_t port, std::string name)
+        : m_loop(loop), m_name(std::move(name))
+{
+    sockaddr_storage addr{};
+    const socklen_t addr_len = Connector::make_inet_address(ip, port, &addr);
+    if (addr_len == 0)
+    {
+        throw std::system_error(EINVAL, std::generic_category(), "TcpClient ip");
+    }
+    m_connector = std::make_unique<Connector>(loop, (sockaddr *) &addr, addr_len);
+    m_connector->set_on_connected([this](int sock_fd) { on_new_connection(sock_fd); });
+}
+
+TcpClient::TcpClient(EventLoop *loop, const std::string &unix_path, std::string name)
+        : m_loop(loop), m_name(std::move(name))
+{
+    sockaddr_storage addr{};
+    const socklen_t addr_len = Connector::make_unix_address(unix_path, &addr);
+    if (addr_len == 0)
+    {
+        throw std::system_error(ENAMETOOLONG, std::generic_category(), "TcpClient unix path");
+    }
+    m_connector = std::make_unique<Connector>(loop, (sockaddr *) &addr, addr_len);
+    m_connector->set_on_connected([this](int sock_fd) { on_new_connection(sock_fd); });
+}
+
+TcpClient::~TcpClient()
+{
+    m_loop->assertInLoopThread();
+    m_connector->stop();
+
+    std::shared_ptr<TcpConnection> conn;
+    {
+        std::lock_guard lock(m_mutex);
+        conn.swap(m_connection);
+    }
+
+    if (conn != nullptr)
+    {
+        // la connexion survit au client le temps de sa fermeture : plus aucun callback ne doit viser this ni le
+        // propriétaire du client (données encore en route, state_change de connection_destroyed)
+        auto callbacks = std::make_shared<ConnectionCallbacks>();
+        callbacks->closed = [](const auto &c) { c->event_loop()->queue([c] { c->connection_destroyed(); }); };
+        callbacks->fill_noop();
+        conn->set_callbacks(std::move(callbacks));
+        m_loop->queue([conn] { conn->brute_close(); });
+    }
+}
+
+void TcpClient::connect()
+{
+    m_connect = true;
+    m_loop->run([this] { m_connector->start(); });
+}
+
+void TcpClient::disconnect()
+{
+    m_connect = false;
+    m_loop->run([this]
+    {
+        m_connector->stop();
+        if (auto conn = connection(); conn != nullptr)
+        {
+            conn->graceful_shutdown();
+        }
+    });
+}
+
+void TcpClient::set_retry_delay(uint32_t init_ms, uint32_t max_ms)
+{
+    m_loop->run([this, init_ms, max_ms] { m_connector->set_retry_delay(init_ms, max_ms); });
+}
+
+std::shared_ptr<TcpConnection> TcpClient::connection() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_connection;
+}
+
+void TcpClient::on_new_connection(int sock_fd)
+{
+    m_loop->assertInLoopThread();
+
+    const PeerAddress peer(m_connector->address(), m_connector->address_len());
+
+    if (peer.family() != AF_UNIX)
+    {
+        if (int yes = 1; setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)) != 0)
+        {
+            perror("Fail to set tcp no delay on client");
+        }
+    }
+
+    auto conn = std::make_shared<TcpConnection>(m_loop, sock_fd, peer, TcpConnection::generate_id());
+    DEBUG_D("TcpClient %s connected sock_fd : %d id %ld", m_name.c_str(), sock_fd, conn->conn_id());
+
+    auto callbacks = std::make_shared<ConnectionCallbacks>();
+    callbacks->state_change = m_connection_state_change_cb;
+    callbacks->data_received = m_data_received_cb;
+    callbacks->write_complete = m_write_complete_cb;
+    callbacks->closed = [this](const auto &_arg)
+    {
+        // une connexion migrée (TcpConnection::migrate_to) se ferme dans le thread d'une autre boucle
+        if (m_loop->isInLoopThread())
+        {
+            remove_connection_internal(_arg);
+            return;
+        }
+        m_loop->queue([this, conn = _arg] { remove_connection_internal(conn); });
+    };
+    callbacks->fill_noop();
+    conn->set_callbacks(std::move(callbacks));
+    {
+        std::lock_guard lock(m_mutex);
+        m_connection = conn;
+    }
+    m_loop->queue([conn] { conn->connection_established(); });
+}
+
+void TcpClient::remove_connection_internal(std::shared_ptr<TcpConnection> const &conn)
+{
+    m_loop->assertInLoopThread();
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_connection == conn)
+        {
+            m_connection = nullptr;
+        }
+    }
+    conn->event_loop()->queue([conn] { conn->connection_destroyed(); });
+
+    if (m_retry && m_connect)
+    {
+        DEBUG_D("TcpClient %s reconnecting", m_name.c_str());
+        m_connector->restart();
+    }
+}
@@ -11,179 +11,783 @@
 #include <cassert>
 #include <sys/socket.h>
 #include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <cstring>
+#include <deque>
+#include <malloc.h>
+#include <memory_resource>
 #include <utility>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <system_error>
 #include "buffer/ByteStream.h"
 #include "buffer/ProtoBuffer.h"
-#include "timeutils/TimeUtils.hpp"
+#include "ResponseSequencer.hpp"
+#include "MirroredRing.hpp"
+#include "SharedPayload.hpp"
+#include "CoroutineState.h"
+#include "TlsState.h"
 
-TcpConnection::TcpConnection(EventLoop *loop, int sock_fd, std::string ip, const uint16_t port, const int family, const long conn_id)
-        : m_loop(loop), m_fd(sock_fd), m_ip(std::move(ip)), m_port(port), m_family(family), m_conn_id(conn_id),
-          m_channel(std::make_unique<Channel>(loop, sock_fd, true)), m_outgoing_byte_stream(std::make_unique<ByteStream>()) {
-    assert(loop);
+// budget mémoire d'une connexion inactive, hors bloc de contrôle de make_shared et entrée de l'Acceptor
+#define CONNECTION_SIZE_BUDGET 256
+
+static std::atomic_long next_conn_id;
+
+// Connexions en cours de migration (voir migrate_to) et appels reçus d'autres threads pendant le transfert, rejoués
+// par la boucle cible. Réparties par conn_id : rien n'est ajouté à chaque connexion et les appels de connexions
+// différentes se partagent rarement un verrou.
+#define MIGRATION_STRIPES 64
+
+struct MigrationStripe {
+    std::mutex mutex;
+    std::unordered_map<const TcpConnection *, std::vector<std::function<void()>>> in_transit;
+};
+
+static MigrationStripe migration_stripes[MIGRATION_STRIPES];
+
+static MigrationStripe &migration_stripe(long conn_id) {
+    return migration_stripes[(unsigned long) conn_id % MIGRATION_STRIPES];
+}
+
+// Les blocs du deque (table et nœuds) passent par la file elle-même, qui les compte : trim_idle() rapporte ce
+// qu'elle rend vraiment et non la taille de l'objet
+struct TcpConnection::SharedQueue : std::pmr::memory_resource {
+    size_t heap_bytes{0};
+    std::pmr::deque<SharedSegment> segments{this};
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        heap_bytes += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        heap_bytes -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
 
-    m_last_event_time = TimeUtils::current_time_in_millis();
+    [[nodiscard]] bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+struct TcpConnection::BridgeState {
+    std::shared_ptr<TcpConnection> peer;
+    int pipe_fds[2]{-1, -1};
+    uint32_t pipe_bytes{0};
+    uint32_t pipe_capacity{0};
+    bool read_blocked{false};
+};
+
+struct TcpConnection::LatencyTrace {
+    LatencyStats *stats;
+    int64_t recv_ns{0};    // dernière lecture pas encore suivie d'une sortie vidée
+    int64_t enqueue_ns{0}; // première écriture sur une sortie vide
+    bool kernel_timestamps{false};
+};
+
+struct TcpConnection::RingInput {
+    std::unique_ptr<MirroredRing> ring; // rendue au pool quand la connexion est inactive ou détruite
+    uint32_t min_capacity;
+    RingDataCallback on_data;
+};
+
+static_assert(sizeof(TcpConnection) <= CONNECTION_SIZE_BUDGET, "TcpConnection exceeds its per-connection memory budget");
+
+void ConnectionCallbacks::fill_noop() {
+    if (!state_change) state_change = [](std::shared_ptr<TcpConnection> const &) {};
+    if (!write_complete) write_complete = [](std::shared_ptr<TcpConnection> const &) {};
+    if (!closed) closed = [](std::shared_ptr<TcpConnection> const &) {};
+    if (!data_received) data_received = [](std::shared_ptr<TcpConnection> const &, ProtoBuffer *, int64_t) {};
+}
+
+static std::shared_ptr<const ConnectionCallbacks> const &empty_callbacks() {
+    static const auto callbacks = [] {
+        auto table = std::make_shared<ConnectionCallbacks>();
+        table->fill_noop();
+        return std::shared_ptr<const ConnectionCallbacks>(std::move(table));
+    }();
+    return callbacks;
+}
+
+TcpConnection::TcpConnection(EventLoop *loop, int sock_fd, PeerAddress const &peer, const long conn_id)
+        : m_loop(loop), m_read_size(loop->read_size_initial()), m_callbacks(empty_callbacks()),
+          m_channel(loop, sock_fd, true), m_conn_id(conn_id), m_peer(peer) {
+    assert(loop);
 
-    m_channel->set_read_cb([this](int64_t received_time) { handle_read(received_time); });
-    m_channel->set_write_cb([this] { handle_write(); });
-    m_channel->set_close_cb([this] { handle_close(0); });
-    m_channel->set_error_cb([this] { handle_error(0); });
-    m_channel->set_periodic_notification_cb([this](auto now) { on_periodic_notification(now); });
+    m_last_event_time = m_loop->now_ms();
+    m_channel.set_handler(this);
 }
 
 TcpConnection::~TcpConnection() {
-    ::close(m_fd);
+    bridge_close_pipe();
+    ::close(m_channel.fd());
     if (m_outgoing_byte_stream != nullptr) {
         m_outgoing_byte_stream->clean();
         m_outgoing_byte_stream = nullptr;
     }
 
-    DEBUG_D("TcpConnection::dtor[%ld] fd is %d ip is %s status is %s", m_conn_id, m_fd, ip_addr().c_str(), state_str().c_str());
+    DEBUG_D("TcpConnection::dtor[%ld] fd is %d status is %s", m_conn_id, m_channel.fd(), state_str().c_str());
+}
+
+ConnectionCallbacks &TcpConnection::own_callbacks() {
+    auto callbacks = std::make_shared<ConnectionCallbacks>(*m_callbacks);
+    m_callbacks = callbacks;
+    return *callbacks;
+}
+
+long TcpConnection::generate_id() {
+    return ++next_conn_id;
 }
 
 void TcpConnection::connection_established() {
-    DEBUG_D("CONN ESTABLISHED for %d [%s] state is %s", m_channel->fd(), ip_addr().c_str(), state_str().c_str());
+    DEBUG_D("CONN ESTABLISHED for %d [%ld] state is %s", m_channel.fd(), m_conn_id, state_str().c_str());
     m_loop->assertInLoopThread();
     assert(m_state == kConnecting);
     m_state = kConnected;
-    m_channel->enable_reading();
-    m_connection_state_change_cb(shared_from_this());
-    m_last_event_time = TimeUtils::current_time_in_millis();
-    set_timeout(15);//just to detect and close useless conn
+    if (m_loop->sticky_write_interest()) {
+        m_sticky_out = true;
+        m_channel.enable_reading_and_writing();
+    } else {
+        m_channel.enable_reading();
+    }
+    set_timeout(15);//just to detect and close useless conn, le callback peut le surcharger
+    if (m_tls != nullptr) {
+        // le callback attend la fin du handshake, borné par le même délai
+        tls_begin();
+        return;
+    }
+    m_callbacks->state_change(shared_from_this());
+}
+
+void TcpConnection::start_tls(std::shared_ptr<TlsContext> context) {
+    assert(m_state == kConnecting && m_tls == nullptr);
+    m_tls = std::make_unique<TlsState>();
+    m_tls->context = std::move(context);
+}
+
+bool TcpConnection::tls_handshaking() const {
+    return m_tls != nullptr && !m_tls->established;
+}
+
+bool TcpConnection::is_ktls_tx() const {
+    return m_tls != nullptr && m_tls->ktls_tx;
+}
+
+bool TcpConnection::is_ktls_rx() const {
+    return m_tls != nullptr && m_tls->ktls_rx;
 }
 
 void TcpConnection::on_periodic_notification(const int64_t now) {
     // DEBUG_D("Periodic event %ld fd is %d", m_conn_id, m_fd);
 
     check_timeout(now);
+    trim_idle(now);
+}
+
+// Après une rafale, un ByteStream ou une file de broadcast garde sa capacité tant que la connexion vit :
+// une connexion redevenue silencieuse les rend, ils seront réalloués à la prochaine écriture.
+void TcpConnection::trim_idle(const int64_t now) {
+    static const size_t empty_string_capacity = std::string().capacity();
+
+    const bool co_input = m_co != nullptr && m_co->input.empty() && m_co->consumed == 0 && m_co->input.capacity() > empty_string_capacity;
+    const bool ring = m_ring != nullptr && m_ring->ring != nullptr && m_ring->ring->empty();
+    if (m_outgoing_byte_stream == nullptr && m_shared_out == nullptr && !co_input && !ring) {
+        return;
+    }
+
+    const uint32_t trim_ms = m_loop->idle_trim_ms();
+    if (trim_ms == 0 || m_state != kConnected || now - std::max(m_last_event_time, m_last_write_time) < trim_ms || has_pending_output()) {
+        return;
+    }
+
+    size_t reclaimed = 0;
+    if (m_outgoing_byte_stream != nullptr) {
+        // sans sortie en attente, ses buffers sont déjà revenus à leur pool : reste le bloc du ByteStream
+        reclaimed += malloc_usable_size(m_outgoing_byte_stream.get());
+        m_outgoing_byte_stream->clean();
+        m_outgoing_byte_stream = nullptr;
+    }
+    if (m_shared_out != nullptr) {
+        reclaimed += malloc_usable_size(m_shared_out.get()) + m_shared_out->heap_bytes;
+        m_shared_out = nullptr;
+    }
+    if (co_input) {
+        // la coroutine n'a ni lecture en cours ni vue sur ce buffer (consumed == 0) ; + 1 pour le '\0'
+        reclaimed += m_co->input.capacity() + 1;
+        std::string().swap(m_co->input);
+    }
+    if (ring) {
+        // rendue au pool de la boucle, une autre sera prise à la prochaine lecture
+        reclaimed += m_ring->ring->capacity();
+        release_ring();
+    }
+    DEBUG_D("Idle trim for %ld: %zu bytes", m_conn_id, reclaimed);
+    m_loop->record_idle_trim(reclaimed);
 }
 
 void TcpConnection::handle_read(const int64_t receiveTime) {
     m_loop->assertInLoopThread();
 
+    if (tls_handshaking()) {
+        tls_handshake();
+        return;
+    }
+    if (bridge_peer() != nullptr) {
+        bridge_read();
+        return;
+    }
+
+    m_read_resume_queued = false;
+    if (m_read_paused != 0) {
+        return;
+    }
+    if (m_ring != nullptr) {
+        ring_read(receiveTime);
+        return;
+    }
+    const uint32_t budget_bytes = m_loop->read_budget_bytes();
+    const uint32_t budget_calls = m_loop->read_budget_calls();
+    uint64_t read_bytes = 0;
+    uint32_t read_calls = 0;
+
     ProtoBuffer *buffer = m_loop->network_buffer();
     while (true) {
         buffer->rewind();
-        const ssize_t readCount = recv(m_channel->fd(), buffer->bytes(), READ_BUFFER_SIZE, MSG_DONTWAIT);
+        // un petit message ne touche que le début du buffer de la boucle, le reste ne quitte pas la mémoire froide
+        const uint32_t read_size = std::min(m_read_size, buffer->capacity());
+        int64_t kernel_rx_ns = 0;
+        const ssize_t readCount = m_latency != nullptr && m_latency->kernel_timestamps && m_tls == nullptr
+                                  ? recv_timestamped(buffer->bytes(), read_size, &kernel_rx_ns)
+                                  : recv_bytes(buffer->bytes(), read_size);
         const int local_errno = errno;
-        DEBUG_D("Handle read count %ld info %d", readCount, m_channel->fd());
+        DEBUG_D("Handle read count %ld info %d", readCount, m_channel.fd());
         if (readCount < 0) {
             if (local_errno == EAGAIN || local_errno == EWOULDBLOCK) {
                 break;
             }
 
-            DEBUG_F("connection recv failed. errno is %d. client %ld [%s]: %s", local_errno, m_conn_id, ip_addr().c_str(), strerror(local_errno));
+            char peer[PeerAddress::kMaxFormatted];
+            m_peer.format(peer, sizeof(peer));
+            DEBUG_F("connection recv failed. errno is %d. client %ld [%s]: %s", local_errno, m_conn_id, peer, strerror(local_errno));
             handle_error(local_errno);
             return;
         }
 
         if (readCount == 0) {
-            DEBUG_W("Closing sock on read 0 %s %hd", ip_addr().c_str(), port());
+            char peer[PeerAddress::kMaxFormatted];
+            m_peer.format(peer, sizeof(peer));
+            DEBUG_W("Closing sock on read 0 %ld [%s]", m_conn_id, peer);
             handle_close(0);
             return;
         }
 
+        adapt_read_size((uint32_t) readCount);
         buffer->limit((uint32_t) readCount);
-        m_last_event_time = TimeUtils::current_time_in_millis();
-        m_data_received_cb(shared_from_this(), buffer, receiveTime);
-        if (m_state != kConnected) return;
+        m_last_event_time = m_loop->now_ms();
+        if (m_loop->traffic_sampling()) {
+            m_loop->record_traffic(this, (uint64_t) readCount);
+        }
+        if (m_latency != nullptr) {
+            LatencyStats *stats = m_latency->stats;
+            const int64_t recv_ns = latency_clock_ns();
+            if (kernel_rx_ns > 0) {
+                // les horodatages du noyau sont en CLOCK_REALTIME
+                stats->kernel.record(latency_clock_ns(CLOCK_REALTIME) - kernel_rx_ns);
+            }
+            stats->loop.record(recv_ns - m_loop->poll_return_ns());
+            if (m_latency->recv_ns == 0) {
+                m_latency->recv_ns = recv_ns;
+            }
+        }
+
+        m_lowat_requested = false;
+        if (m_co != nullptr) {
+            co_on_data(buffer->bytes(), (uint32_t) readCount);
+        } else if (m_latency != nullptr) {
+            const int64_t dispatch_ns = latency_clock_ns();
+            LatencyStats *stats = m_latency->stats;
+            m_callbacks->data_received(shared_from_this(), buffer, receiveTime);
+            stats->handler.record(latency_clock_ns() - dispatch_ns);
+        } else {
+            m_callbacks->data_received(shared_from_this(), buffer, receiveTime);
+        }
+        if (m_state != kConnected || m_read_paused != 0 || !after_frame_callback()) return;
+
+        read_bytes += (uint64_t) readCount;
+        ++read_calls;
+        if ((budget_bytes != 0 && read_bytes >= budget_bytes) || (budget_calls != 0 && read_calls >= budget_calls)) {
+            yield_read();
+            return;
+        }
+    }
+}
+
+// Le socket n'a pas rendu EAGAIN : en edge-triggered epoll ne le signalera plus, on reprend donc la lecture à
+// l'itération suivante, après les autres connexions prêtes. La boucle ne bloque pas tant qu'il reste des reprises.
+void TcpConnection::yield_read() {
+    if (m_read_resume_queued) return;
+    m_read_resume_queued = true;
+    DEBUG_D("Read budget exhausted for %ld, yielding", m_conn_id);
+    std::weak_ptr<TcpConnection> weak = weak_from_this();
+    m_loop->queue_next_iteration([weak, loop = m_loop] {
+        auto self = weak.lock();
+        // une connexion migrée entre-temps est relue par sa nouvelle boucle
+        if (self == nullptr || self->event_loop() != loop || !self->m_read_resume_queued) return;
+        if (self->m_state == kConnected) {
+            self->handle_read(self->m_loop->now_ms());
+        }
+    });
+}
+
+bool TcpConnection::enable_input_ring(uint32_t min_capacity, RingDataCallback on_data) {
+    m_loop->assertInLoopThread();
+    assert(m_co == nullptr && bridge_peer() == nullptr);
+    auto input = std::make_unique<RingInput>();
+    try {
+        input->ring = m_loop->ring_pool()->acquire(min_capacity);
+    } catch (const std::system_error &e) {
+        DEBUG_E("Input ring for %ld failed: %s", m_conn_id, e.what());
+        return false;
+    }
+    input->min_capacity = min_capacity;
+    input->on_data = std::move(on_data);
+    m_ring = std::move(input);
+    return true;
+}
+
+void TcpConnection::release_ring() {
+    if (m_ring != nullptr && m_ring->ring != nullptr) {
+        m_loop->ring_pool()->release(std::move(m_ring->ring));
+    }
+}
+
+// Comme handle_read, mais recv écrit directement dans l'espace libre de la ring : pas de copie vers un buffer
+// de la boucle, et les octets non consommés restent en place jusqu'à la lecture suivante.
+void TcpConnection::ring_read(const int64_t receive_time) {
+    if (m_ring->ring == nullptr) {
+        try {
+            m_ring->ring = m_loop->ring_pool()->acquire(m_ring->min_capacity);
+        } catch (const std::system_error &e) {
+            DEBUG_E("Input ring for %ld failed: %s", m_conn_id, e.what());
+            handle_error(e.code().value());
+            return;
+        }
+    }
+
+    const uint32_t budget_bytes = m_loop->read_budget_bytes();
+    const uint32_t budget_calls = m_loop->read_budget_calls();
+    uint64_t read_bytes = 0;
+    uint32_t read_calls = 0;
+    while (true) {
+        MirroredRing &ring = *m_ring->ring;
+        if (ring.writable() == 0) {
+            DEBUG_E("Input ring full for %ld (%u bytes), frame too large", m_conn_id, ring.capacity());
+            handle_error(EMSGSIZE);
+            return;
+        }
+
+        const ssize_t readCount = recv_bytes(ring.write_ptr(), ring.writable());
+        const int local_errno = errno;
+        if (readCount < 0) {
+            if (local_errno == EAGAIN || local_errno == EWOULDBLOCK) {
+                break;
+            }
+            DEBUG_F("connection recv failed. errno is %d. client %ld: %s", local_errno, m_conn_id, strerror(local_errno));
+            handle_error(local_errno);
+            return;
+        }
+        if (readCount == 0) {
+            DEBUG_W("Closing sock on read 0 %ld", m_conn_id);
+            handle_close(0);
+            return;
+        }
+
+        ring.produce((uint32_t) readCount);
+        m_last_event_time = m_loop->now_ms();
+        if (m_loop->traffic_sampling()) {
+            m_loop->record_traffic(this, (uint64_t) readCount);
+        }
+        m_lowat_requested = false;
+        const uint32_t consumed = m_ring->on_data(shared_from_this(), ring.data(), ring.readable(), receive_time);
+        if (m_state != kConnected || m_ring == nullptr || m_ring->ring == nullptr) return;
+        assert(consumed <= ring.readable());
+        ring.consume(consumed);
+        if (m_read_paused != 0 || !after_frame_callback()) return;
+
+        read_bytes += (uint64_t) readCount;
+        ++read_calls;
+        if ((budget_bytes != 0 && read_bytes >= budget_bytes) || (budget_calls != 0 && read_calls >= budget_calls)) {
+            yield_read();
+            return;
+        }
+    }
+}
+
+void TcpConnection::await_frame_bytes(uint32_t missing) {
+    m_loop->assertInLoopThread();
+    // AF_UNIX : poll ignore SO_RCVLOWAT et setsockopt ne signale pas un seuil déjà atteint.
+    // TLS : le seuil compterait des octets chiffrés, et OpenSSL peut déjà détenir la suite de la trame.
+    if (missing <= (uint32_t) m_callbacks->rcvlowat || m_peer.family() == AF_UNIX || m_tls != nullptr) {
+        reset_rcvlowat();
+        return;
+    }
+    const int lowat = (int) std::min<uint32_t>(missing, RCVLOWAT_MAX);
+    if (::setsockopt(m_channel.fd(), SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat)) != 0) {
+        DEBUG_W("SO_RCVLOWAT %d failed for %ld: %s", lowat, m_conn_id, strerror(errno));
+        return;
+    }
+    m_lowat_raised = true;
+    m_lowat_requested = true;
+    m_loop->count_rcvlowat_arm();
+}
+
+void TcpConnection::reset_rcvlowat() {
+    if (!m_lowat_raised) return;
+    // seuil du profil du listener, pas celui du noyau
+    const int lowat = m_callbacks->rcvlowat;
+    ::setsockopt(m_channel.fd(), SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+    m_lowat_raised = false;
+}
+
+// Un recv non bloquant rend ce qui est disponible même sous le seuil : après un await_frame_bytes() on arrête de
+// lire, le noyau signalera EPOLLIN (setsockopt le fait aussitôt si le seuil est déjà atteint).
+bool TcpConnection::after_frame_callback() {
+    if (m_lowat_requested) {
+        m_lowat_requested = false;
+        return false;
+    }
+    reset_rcvlowat();
+    return true;
+}
+
+// Lecture pleine : on double pour vider un gros flux en moins d'appels. Deux lectures de suite sous le quart :
+// on divise par deux, pour qu'un pic isolé ne laisse pas une connexion de heartbeats lire par blocs de 2 Mo.
+void TcpConnection::adapt_read_size(uint32_t read_count) {
+    if (read_count >= m_read_size) {
+        m_read_size = std::min(m_read_size * 2, m_loop->read_size_max());
+        m_read_shrink_streak = 0;
+    } else if (read_count <= m_read_size / 4) {
+        if (++m_read_shrink_streak >= 2) {
+            m_read_size = std::max(m_read_size / 2, m_loop->read_size_min());
+            m_read_shrink_streak = 0;
+        }
+    } else {
+        m_read_shrink_streak = 0;
     }
 }
 
 void TcpConnection::handle_write() {
     m_loop->assertInLoopThread();
 
-    DEBUG_D("Handle write. for %d [%s] state is %s", m_channel->fd(), ip_addr().c_str(), state_str().c_str());
+    DEBUG_D("Handle write. for %d [%ld] state is %s", m_channel.fd(), m_conn_id, state_str().c_str());
 
-    if (!m_channel->has_write_op()) {
-        DEBUG_W("HANDLE WRITE CALLED... but NOT WRITE OPS. %ld [%s] state is %s", conn_id(), ip_addr().c_str(),state_str().c_str());
+    if (!m_channel.has_write_op()) {
+        DEBUG_W("HANDLE WRITE CALLED... but NOT WRITE OPS. %ld state is %s", conn_id(), state_str().c_str());
         return;
     }
 
-    ProtoBuffer *buffer = m_loop->network_buffer();
-    buffer->clear();
-    m_outgoing_byte_stream->get(buffer);
-    buffer->flip();
-
-    if (uint32_t remaining = buffer->remaining(); remaining != 0) {
-        uint32_t total_sent = 0;
-        while (true) {
-            ssize_t sent_length = ::send(m_channel->fd(), buffer->bytes() + total_sent, remaining, MSG_NOSIGNAL | MSG_DONTWAIT);
-            const int local_errno = errno;
-            if (sent_length < 0) {
-                if (local_errno == EWOULDBLOCK || local_errno == EAGAIN) {
-                    DEBUG_W("Got would block on tks send for %d [%s] state is %s", m_channel->fd(), ip_addr().c_str(), state_str().c_str());
-                    break;
-                }
-                DEBUG_E("Error when writing on socket errno %d", local_errno);
-                handle_error(local_errno);
-                return;
-            }
+    if (tls_handshaking()) {
+        tls_handshake();
+        return;
+    }
 
-            m_outgoing_byte_stream->discard(sent_length);
-            if (!m_outgoing_byte_stream->has_data()) {
-                m_channel->disable_write();
-                auto self = shared_from_this();
-                m_loop->queue([self] { self->m_write_completed_cb(self->shared_from_this()); });
-                if (m_state == kDisconnecting) {
-                    graceful_shutdown_internal();
-                }
+    if (m_sticky_out && !has_pending_output()) {
+        // EPOLLOUT permanent : en edge-triggered il accompagne chaque EPOLLIN, rien à envoyer
+        if (bridge_peer() != nullptr) {
+            bridge_write();
+        }
+        return;
+    }
+
+    // en mode bridge, l'EPOLLOUT peut ne servir qu'à vider le pipe : write_complete seulement si la sortie de
+    // l'application a été envoyée
+    const bool flushing = has_pending_output();
+
+    // epoll est en edge-triggered : on écrit jusqu'à vider la file ou remplir le socket
+    while (has_pending_output()) {
+        if (m_shared_out != nullptr && !m_shared_out->segments.empty() && m_shared_out->segments.front().stream_offset == m_stream_sent) {
+            SharedSegment &segment = m_shared_out->segments.front();
+            const ssize_t sent_length = send_bytes(segment.payload->bytes() + segment.sent, segment.payload->size() - segment.sent);
+            if (sent_length <= 0) {
+                return;
             }
-            total_sent += sent_length;
-            remaining -= sent_length;
-            if (remaining == 0) {
-                break;
+            segment.sent += (uint32_t) sent_length;
+            if (segment.sent == segment.payload->size()) {
+                m_shared_out->segments.pop_front();
             }
+            continue;
+        }
+
+        ProtoBuffer *buffer = m_loop->send_buffer();
+        buffer->clear();
+        if (m_shared_out != nullptr && !m_shared_out->segments.empty()) {
+            // ne pas dépasser le prochain payload partagé, l'ordre des écritures doit être conservé
+            buffer->limit((uint32_t) std::min<uint64_t>(buffer->capacity(), m_shared_out->segments.front().stream_offset - m_stream_sent));
+        }
+        m_outgoing_byte_stream->get(buffer);
+        buffer->flip();
+
+        const ssize_t sent_length = send_bytes(buffer->bytes(), buffer->remaining());
+        if (sent_length <= 0) {
+            return;
         }
+        m_outgoing_byte_stream->discard((uint32_t) sent_length);
+        m_stream_sent += (uint64_t) sent_length;
+    }
+
+    if (!m_sticky_out) {
+        m_channel.disable_write();
+    }
+    if (flushing) {
+        if (m_latency != nullptr) {
+            trace_drained();
+        }
+        auto self = shared_from_this();
+        // par run_in_loop : si la connexion migre d'ici là, le callback est appelé dans sa nouvelle boucle
+        m_loop->queue([self] { self->run_in_loop([self] { self->m_callbacks->write_complete(self); }); });
+    }
+    if (m_state == kDisconnecting) {
+        graceful_shutdown_internal();
+    }
+
+    if (bridge_peer() != nullptr) {
+        bridge_write();
+    }
+
+    if (m_co != nullptr) {
+        co_on_drained();
     }
 }
 
+ssize_t TcpConnection::recv_bytes(uint8_t *data, uint32_t length) {
+    // kTLS en réception compris : SSL_read traite aussi les enregistrements de contrôle (alertes, KeyUpdate)
+    if (m_tls != nullptr) {
+        return tls_recv(data, length);
+    }
+    return ::recv(m_channel.fd(), data, length, MSG_DONTWAIT);
+}
+
+ssize_t TcpConnection::send_bytes(const uint8_t *data, uint32_t length) {
+    // kTLS en envoi : le noyau chiffre, send() reste le chemin direct
+    const ssize_t sent_length = m_tls != nullptr && !m_tls->ktls_tx
+                                ? tls_send(data, length)
+                                : ::send(m_channel.fd(), data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+    const int local_errno = errno;
+    if (sent_length < 0) {
+        if (local_errno == EWOULDBLOCK || local_errno == EAGAIN) {
+            m_write_blocked = true;
+            DEBUG_W("Got would block on tks send for %d [%ld] state is %s", m_channel.fd(), m_conn_id, state_str().c_str());
+            return 0;
+        }
+        DEBUG_E("Error when writing on socket errno %d", local_errno);
+        handle_error(local_errno);
+        return -1;
+    }
+    return sent_length;
+}
+
+bool TcpConnection::has_pending_output() const {
+    return (m_shared_out != nullptr && !m_shared_out->segments.empty()) || (m_outgoing_byte_stream != nullptr && m_outgoing_byte_stream->has_data());
+}
+
 void TcpConnection::handle_error(int local_errno) {
     if (local_errno == 0) {
         int opt_val;
         socklen_t opt_len = sizeof opt_val;
-        if (::getsockopt(m_channel->fd(), SOL_SOCKET, SO_ERROR, &opt_val, &opt_len) == 0) {
+        if (::getsockopt(m_channel.fd(), SOL_SOCKET, SO_ERROR, &opt_val, &opt_len) == 0) {
             local_errno = opt_val;
         }
     }
 
     // Si l'erreur est "saine", on ne fait rien et on continue
     if (local_errno == 0 || local_errno == EAGAIN || local_errno == EWOULDBLOCK || local_errno == EINTR) {
-        DEBUG_W("[EventLoop][%s] Socket transient warning fd=%d: err=%d desc=%s. Ignored.",ip_addr().c_str(), m_channel->fd(), local_errno, std::strerror(local_errno));
+        DEBUG_W("[EventLoop][%ld] Socket transient warning fd=%d: err=%d desc=%s. Ignored.", m_conn_id, m_channel.fd(), local_errno, std::strerror(local_errno));
         return;
     }
 
-    DEBUG_E("[EventLoop][%s] CLOSING SOCKET fd=%d: err=%d desc=%s", ip_addr().c_str(), m_channel->fd(), local_errno, std::strerror(local_errno));
+    char peer[PeerAddress::kMaxFormatted];
+    m_peer.format(peer, sizeof(peer));
+    DEBUG_E("[EventLoop][%ld %s] CLOSING SOCKET fd=%d: err=%d desc=%s", m_conn_id, peer, m_channel.fd(), local_errno, std::strerror(local_errno));
     handle_close(1);
 }
 
 void TcpConnection::handle_close(const int reason) {
     m_loop->assertInLoopThread();
-    DEBUG_W("Close called with reason %d. state is %s on fd %d", reason, state_str().c_str(), m_channel->fd());
+    DEBUG_W("Close called with reason %d. state is %s on fd %d", reason, state_str().c_str(), m_channel.fd());
 
     if (m_state == kDisconnected) return;
     assert(m_state == kConnected || m_state == kDisconnecting);
 
     m_state = kDisconnected;
 
-    m_last_event_time = TimeUtils::current_time_in_millis();
+    m_last_event_time = m_loop->now_ms();
+
+    m_channel.disable_all();
+
+    if (bridge_peer() != nullptr) {
+        auto peer = std::move(m_bridge->peer);
+        // dernière chance pour les octets déjà dans notre pipe, puis l'autre côté est fermé aussi
+        peer->bridge_write();
+        peer->m_bridge->peer = nullptr;
+        bridge_close_pipe();
+        peer->bridge_close_pipe();
+        if (peer->m_state == kConnected || peer->m_state == kDisconnecting) {
+            peer->handle_close(reason);
+        }
+    }
+
+    auto self = shared_from_this();
+    m_callbacks->closed(self);
 
-    m_channel->disable_all();
-    m_connection_close_cb(shared_from_this());
+    if (m_co != nullptr) {
+        co_on_closed();
+    }
 }
 
 void TcpConnection::connection_destroyed()
 {
     m_loop->assertInLoopThread();
     assert(m_state == kDisconnected);
-    m_loop->remove_channel(m_channel.get());
-    m_connection_state_change_cb(shared_from_this());
+    m_loop->remove_channel(&m_channel);
+    release_ring();
+    if (m_tls != nullptr && !m_tls->established) {
+        // handshake échoué : la connexion n'a jamais été annoncée
+        return;
+    }
+    m_callbacks->state_change(shared_from_this());
+}
+
+void TcpConnection::run_in_loop(std::function<void()> fn) {
+    for (;;) {
+        // hors migration : ni verrou ni table, l'appel est seulement compté le temps de le poster
+        if ((m_transit.fetch_add(1) & kInTransit) == 0) {
+            EventLoop *loop = event_loop();
+            if (loop->isInLoopThread()) {
+                m_transit.fetch_sub(1);
+                fn();
+                return;
+            }
+            loop->queue(fn);
+            m_transit.fetch_sub(1);
+            return;
+        }
+        m_transit.fetch_sub(1);
+
+        MigrationStripe &stripe = migration_stripe(m_conn_id);
+        std::lock_guard lock(stripe.mutex);
+        auto it = stripe.in_transit.find(this);
+        if (it != stripe.in_transit.end()) {
+            it->second.push_back(std::move(fn));
+            return;
+        }
+        // migration terminée entre-temps (kInTransit est retiré sous ce verrou) : chemin rapide
+    }
+}
+
+bool TcpConnection::migrate_to(EventLoop *target) {
+    m_loop->assertInLoopThread();
+    if (target == nullptr || target == m_loop || m_state != kConnected || m_co != nullptr || bridge_peer() != nullptr ||
+        tls_handshaking()) {
+        return false;
+    }
+    {
+        MigrationStripe &stripe = migration_stripe(m_conn_id);
+        std::lock_guard lock(stripe.mutex);
+        if (!stripe.in_transit.try_emplace(this).second) {
+            return false;
+        }
+        m_transit.fetch_or(kInTransit);
+    }
+    // les appels qui n'ont pas vu kInTransit finissent de poster vers cette boucle, avant migrate_detach
+    while ((m_transit.load() & ~kInTransit) != 0) {
+        std::this_thread::yield();
+    }
+    DEBUG_D("Migrating connection %ld from loop %d to loop %d", m_conn_id, m_loop->pool_index(), target->pool_index());
+    // après les événements déjà collectés pour ce canal et les tâches déjà en file pour cette connexion
+    auto self = shared_from_this();
+    m_loop->queue([self, target] { self->migrate_detach(target); });
+    return true;
+}
+
+void TcpConnection::migrate_detach(EventLoop *target) {
+    m_loop->assertInLoopThread();
+    if (m_state != kConnected || m_co != nullptr || bridge_peer() != nullptr) {
+        // fermée ou devenue non migrable entre-temps : la connexion reste ici
+        migrate_release_backlog();
+        return;
+    }
+
+    if (!m_channel.is_none_events()) {
+        m_channel.disable_all();
+    }
+    m_loop->remove_channel(&m_channel);
+    std::atomic_ref<EventLoop *>(m_loop).store(target, std::memory_order_release);
+    m_channel.move_to(target);
+    auto self = shared_from_this();
+    target->queue([self] { self->migrate_attach(); });
+}
+
+void TcpConnection::migrate_attach() {
+    m_loop->assertInLoopThread();
+    // réglages de la nouvelle boucle ; les envois ou reprises programmés par l'ancienne ne s'exécuteront pas
+    m_sticky_out = m_loop->sticky_write_interest();
+    m_write_blocked = false;
+    m_flush_queued = false;
+    m_read_resume_queued = false;
+    if (m_latency != nullptr) {
+        m_latency->stats = m_loop->enable_latency_stats();
+    }
+
+    // EPOLL_CTL_ADD réévalue le socket : les données arrivées et la place libérée pendant le transfert sont signalées
+    const bool reading = m_read_paused == 0;
+    const bool writing = m_sticky_out || has_pending_output();
+    if (reading && writing) {
+        m_channel.enable_reading_and_writing();
+    } else if (reading) {
+        m_channel.enable_reading();
+    } else if (writing) {
+        m_channel.enable_writing();
+    } else {
+        // lecture suspendue sans envoi en attente : inscrit pour les notifications périodiques, sans événement
+        m_loop->register_channel(&m_channel);
+    }
+    DEBUG_D("Connection %ld attached to loop %d", m_conn_id, m_loop->pool_index());
+
+    migrate_release_backlog();
+    if (m_state == kConnected && m_read_paused == 0 && m_tls != nullptr && tls_pending()) {
+        // octets déjà déchiffrés par OpenSSL : aucun EPOLLIN ne les signalera
+        yield_read();
+    }
+}
+
+void TcpConnection::migrate_release_backlog() {
+    std::vector<std::function<void()>> backlog;
+    {
+        MigrationStripe &stripe = migration_stripe(m_conn_id);
+        std::lock_guard lock(stripe.mutex);
+        auto it = stripe.in_transit.find(this);
+        assert(it != stripe.in_transit.end());
+        backlog = std::move(it->second);
+        stripe.in_transit.erase(it);
+        m_transit.fetch_and((uint16_t) ~kInTransit);
+    }
+    for (auto &fn: backlog) {
+        fn();
+    }
 }
 
 void TcpConnection::graceful_shutdown() {
     auto self = shared_from_this();
-    m_loop->run([self]
+    run_in_loop([self]
     {
         DEBUG_D("Graceful Shutdown called on conn %ld. state is %s", self->conn_id(), self->state_str().c_str());
         if (self->m_state != kConnected && self->m_state != kConnecting)
@@ -192,7 +796,7 @@ void TcpConnection::graceful_shutdown() {
         }
         self->m_state = kDisconnecting;
         self->m_shutdown_started = true;
-        self->m_shutdown_time = TimeUtils::current_time_in_millis();
+        self->m_shutdown_time = self->m_loop->now_ms();
         self->graceful_shutdown_internal();
     });
 }
@@ -200,15 +804,183 @@ void TcpConnection::graceful_shutdown() {
 //why close is not called directly https://stackoverflow.com/a/23483487/2413201
 void TcpConnection::graceful_shutdown_internal() const {
     m_loop->assertInLoopThread();
-    if (!m_channel->has_write_op()) {
+    if (m_sticky_out ? !has_pending_output() : !m_channel.has_write_op()) {
         //fermer le socket avec élégance
-        ::shutdown(m_channel->fd(), SHUT_WR);
+        if (m_tls != nullptr) {
+            tls_close_notify();
+        }
+        ::shutdown(m_channel.fd(), SHUT_WR);
+    }
+}
+
+bool TcpConnection::bridge(std::shared_ptr<TcpConnection> const &other) {
+    m_loop->assertInLoopThread();
+    if (other.get() == this || other->m_loop != m_loop) {
+        DEBUG_E("Bridge refused between %ld and %ld: both connections must live on the same loop", m_conn_id, other->m_conn_id);
+        return false;
+    }
+    if (!is_connected() || !other->is_connected() || bridge_peer() != nullptr || other->bridge_peer() != nullptr) {
+        return false;
+    }
+    // splice() ne passe pas par OpenSSL : il faut le kTLS dans les deux sens et rien de déjà déchiffré en attente
+    for (const TcpConnection *side: {this, other.get()}) {
+        if (side->m_tls != nullptr && (!side->m_tls->ktls_tx || !side->m_tls->ktls_rx || side->tls_pending())) {
+            DEBUG_W("Bridge refused for %ld: TLS without kernel offload", side->m_conn_id);
+            return false;
+        }
+    }
+    if (!bridge_open_pipe()) {
+        return false;
+    }
+    if (!other->bridge_open_pipe()) {
+        bridge_close_pipe();
+        return false;
+    }
+
+    m_bridge->peer = other;
+    other->m_bridge->peer = shared_from_this();
+    DEBUG_D("Bridge %ld <-> %ld", m_conn_id, other->m_conn_id);
+
+    // epoll est en edge-triggered : ce qui est déjà dans les sockets ne sera pas signalé à nouveau
+    auto self = shared_from_this();
+    m_loop->queue([self, other]
+    {
+        if (self->bridge_peer() == other.get()) {
+            self->bridge_read();
+        }
+        if (other->bridge_peer() == self.get()) {
+            other->bridge_read();
+        }
+    });
+    return true;
+}
+
+TcpConnection *TcpConnection::bridge_peer() const {
+    return m_bridge == nullptr ? nullptr : m_bridge->peer.get();
+}
+
+bool TcpConnection::bridge_open_pipe() {
+    if (m_bridge == nullptr) {
+        m_bridge = std::make_unique<BridgeState>();
+    }
+    BridgeState &bridge = *m_bridge;
+    if (::pipe2(bridge.pipe_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+        const int local_errno = errno;
+        DEBUG_E("Bridge pipe2 failed for %ld: %s", m_conn_id, strerror(local_errno));
+        bridge.pipe_fds[0] = bridge.pipe_fds[1] = -1;
+        return false;
+    }
+    // une pipe plus grande que les 64 KiB par défaut limite les allers-retours entre les deux sockets
+    ::fcntl(bridge.pipe_fds[1], F_SETPIPE_SZ, 256 * 1024);
+    const int capacity = ::fcntl(bridge.pipe_fds[1], F_GETPIPE_SZ);
+    bridge.pipe_capacity = capacity > 0 ? (uint32_t) capacity : 64 * 1024;
+    bridge.pipe_bytes = 0;
+    bridge.read_blocked = false;
+    return true;
+}
+
+void TcpConnection::bridge_close_pipe() {
+    if (m_bridge == nullptr) {
+        return;
+    }
+    for (int &fd: m_bridge->pipe_fds) {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    m_bridge->pipe_bytes = 0;
+}
+
+// socket -> notre pipe -> socket du pair
+void TcpConnection::bridge_read() {
+    if (m_bridge == nullptr) {
+        return;
+    }
+    BridgeState &bridge = *m_bridge;
+    auto peer = bridge.peer;
+    while (peer != nullptr && m_state == kConnected) {
+        if (bridge.pipe_bytes >= bridge.pipe_capacity) {
+            // le pair ne suit pas : on arrête de lire, bridge_write() du pair nous relancera
+            bridge.read_blocked = true;
+            return;
+        }
+
+        const ssize_t n = ::splice(m_channel.fd(), nullptr, bridge.pipe_fds[1], nullptr, bridge.pipe_capacity - bridge.pipe_bytes,
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        const int local_errno = errno;
+        if (n > 0) {
+            bridge.pipe_bytes += (uint32_t) n;
+            m_last_event_time = m_loop->now_ms();
+            peer->bridge_write();
+            continue;
+        }
+
+        if (n == 0) {
+            DEBUG_D("Bridge %ld: peer closed", m_conn_id);
+            handle_close(0);
+            return;
+        }
+
+        if (local_errno == EAGAIN || local_errno == EWOULDBLOCK) {
+            // EAGAIN vient soit du socket vide, soit de la pipe pleine
+            int available = 0;
+            if (bridge.pipe_bytes > 0 && ::ioctl(m_channel.fd(), FIONREAD, &available) == 0 && available > 0) {
+                bridge.read_blocked = true;
+            }
+            return;
+        }
+
+        DEBUG_F("Bridge splice in failed. errno is %d. client %ld: %s", local_errno, m_conn_id, strerror(local_errno));
+        handle_error(local_errno);
+        return;
+    }
+}
+
+// pipe du pair -> notre socket
+void TcpConnection::bridge_write() {
+    TcpConnection *source = bridge_peer();
+    if (source == nullptr || m_state == kDisconnected || has_pending_output()) {
+        // le ByteStream est vidé d'abord, handle_write() nous rappelle ensuite
+        return;
+    }
+
+    BridgeState &source_bridge = *source->m_bridge;
+    while (source_bridge.pipe_bytes > 0) {
+        const ssize_t n = ::splice(source_bridge.pipe_fds[0], nullptr, m_channel.fd(), nullptr, source_bridge.pipe_bytes,
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        const int local_errno = errno;
+        if (n > 0) {
+            source_bridge.pipe_bytes -= (uint32_t) n;
+            continue;
+        }
+
+        if (n < 0 && (local_errno == EAGAIN || local_errno == EWOULDBLOCK)) {
+            m_write_blocked = true;
+            if (!m_channel.has_write_op()) {
+                m_channel.enable_writing();
+            }
+            return;
+        }
+
+        DEBUG_F("Bridge splice out failed. errno is %d. client %ld: %s", local_errno, m_conn_id, strerror(local_errno));
+        handle_error(local_errno);
+        return;
+    }
+
+    if (!m_sticky_out && m_channel.has_write_op()) {
+        m_channel.disable_write();
+    }
+
+    if (source_bridge.read_blocked) {
+        source_bridge.read_blocked = false;
+        source->bridge_read();
     }
 }
 
 void TcpConnection::write_buffer(ProtoBuffer *buffer) {
     auto self = shared_from_this();
-    m_loop->run([self, buffer]
+    run_in_loop([self, buffer]
     {
         if (self->is_connected()) {
             self->write_buffer_internal(buffer);
@@ -219,18 +991,214 @@ void TcpConnection::write_buffer(ProtoBuffer *buffer) {
 
 }
 
-void TcpConnection::write_buffer_internal(ProtoBuffer *buffer) const
+void TcpConnection::write_buffer_internal(ProtoBuffer *buffer)
 {
     m_loop->assertInLoopThread();
+    if (m_latency != nullptr && !has_pending_output()) {
+        trace_enqueue();
+    }
+    if (m_outgoing_byte_stream == nullptr) {
+        m_outgoing_byte_stream = std::make_unique<ByteStream>();
+    }
+    m_stream_appended += buffer->remaining();
     m_outgoing_byte_stream->append(buffer);
-    if (!m_channel->has_write_op() && m_outgoing_byte_stream->has_data()) {
-        m_channel->enable_writing();
+    m_last_write_time = m_loop->now_ms();
+    request_flush();
+}
+
+void TcpConnection::request_flush() {
+    if (!m_sticky_out) {
+        if (!m_channel.has_write_op() && has_pending_output()) {
+            m_channel.enable_writing();
+        }
+        return;
+    }
+
+    // Socket plein : le prochain EPOLLOUT enverra. Sinon aucun front ne viendra, on envoie à l'itération suivante,
+    // une fois pour toutes les écritures de celle-ci.
+    if (m_write_blocked || m_flush_queued || !has_pending_output()) {
+        return;
+    }
+    m_flush_queued = true;
+    std::weak_ptr<TcpConnection> weak = weak_from_this();
+    m_loop->queue_next_iteration([weak, loop = m_loop] {
+        auto self = weak.lock();
+        if (self == nullptr || self->event_loop() != loop) return;
+        self->m_flush_queued = false;
+        if (self->m_state == kConnected || self->m_state == kDisconnecting) {
+            self->handle_write();
+        }
+    });
+}
+
+void TcpConnection::pause_reading() {
+    auto self = shared_from_this();
+    run_in_loop([self] { self->pause_reading_internal(kPauseUser); });
+}
+
+void TcpConnection::resume_reading() {
+    auto self = shared_from_this();
+    run_in_loop([self] { self->resume_reading_internal(kPauseUser); });
+}
+
+void TcpConnection::pause_reading_internal(PauseReason reason) {
+    m_loop->assertInLoopThread();
+    const bool was_reading = m_read_paused == 0;
+    m_read_paused |= reason;
+    if (was_reading && m_state == kConnected && m_channel.is_reading()) {
+        m_channel.disable_reading();
+    }
+}
+
+void TcpConnection::resume_reading_internal(PauseReason reason) {
+    m_loop->assertInLoopThread();
+    if ((m_read_paused & reason) == 0) return;
+    m_read_paused &= ~reason;
+    if (m_read_paused == 0 && m_state == kConnected && !m_channel.is_reading()) {
+        // epoll_ctl réévalue l'état du socket : les données arrivées pendant la pause déclenchent un nouvel événement
+        m_channel.enable_reading();
+        if (m_tls != nullptr && tls_pending()) {
+            // ... mais pas celles qu'OpenSSL a déjà déchiffrées
+            yield_read();
+        }
+    }
+}
+
+void TcpConnection::enable_sequencing(uint32_t max_in_flight) {
+    m_loop->assertInLoopThread();
+    assert(m_sequencer == nullptr);
+    m_sequencer = std::make_unique<ResponseSequencer>(max_in_flight);
+}
+
+uint64_t TcpConnection::reserve_response() {
+    m_loop->assertInLoopThread();
+    assert(m_sequencer != nullptr);
+    const uint64_t slot = m_sequencer->reserve();
+    if (m_sequencer->full()) {
+        DEBUG_D("Sequencer full for %ld (%u in flight), pausing reads", m_conn_id, m_sequencer->in_flight());
+        pause_reading_internal(kPauseSequencer);
+    }
+    return slot;
+}
+
+void TcpConnection::complete_response(uint64_t slot, ProtoBuffer *response) {
+    auto self = shared_from_this();
+    run_in_loop([self, slot, response] { self->complete_response_internal(slot, response); });
+}
+
+void TcpConnection::complete_response_internal(uint64_t slot, ProtoBuffer *response) {
+    m_loop->assertInLoopThread();
+    if (!is_connected() || m_sequencer == nullptr || !m_sequencer->complete(slot, response)) {
+        DEBUG_W("Response %lu dropped for %ld, state is %s", slot, m_conn_id, state_str().c_str());
+        if (response != nullptr) {
+            response->reuse();
+        }
+        return;
+    }
+
+    // un seul passage dans le ByteStream pour tout le lot, envoyé au prochain EPOLLOUT
+    m_sequencer->drain([this](ProtoBuffer *ready) { write_buffer_internal(ready); });
+    if (!m_sequencer->full()) {
+        resume_reading_internal(kPauseSequencer);
+    }
+}
+
+void TcpConnection::write_shared(std::shared_ptr<const SharedPayload> const &payload) {
+    auto self = shared_from_this();
+    run_in_loop([self, payload]
+    {
+        if (self->is_connected()) {
+            self->write_shared_internal(payload);
+        } else {
+            DEBUG_E("WRITE SHARED CALLED WHEN not connected. state is %s", self->state_str().c_str());
+        }
+    });
+}
+
+void TcpConnection::write_shared_internal(std::shared_ptr<const SharedPayload> const &payload)
+{
+    m_loop->assertInLoopThread();
+    if (payload->size() == 0) {
+        return;
+    }
+    if (m_latency != nullptr && !has_pending_output()) {
+        trace_enqueue();
+    }
+    if (m_shared_out == nullptr) {
+        m_shared_out = std::make_unique<SharedQueue>();
+    }
+    m_shared_out->segments.push_back(SharedSegment{payload, m_stream_appended, 0});
+    m_last_write_time = m_loop->now_ms();
+    request_flush();
+}
+
+bool TcpConnection::enable_latency_tracing(bool kernel_timestamps) {
+    m_loop->assertInLoopThread();
+    if (m_latency == nullptr) {
+        m_latency = std::make_unique<LatencyTrace>();
+        m_latency->stats = m_loop->enable_latency_stats();
+    }
+    if (!kernel_timestamps || m_latency->kernel_timestamps) {
+        return true;
+    }
+
+    const int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (::setsockopt(m_channel.fd(), SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+        DEBUG_W("SO_TIMESTAMPING refused for %ld: %s", m_conn_id, strerror(errno));
+        return false;
+    }
+    m_latency->kernel_timestamps = true;
+    return true;
+}
+
+// recv() avec l'horodatage logiciel RX du noyau, 0 dans kernel_rx_ns s'il est absent
+ssize_t TcpConnection::recv_timestamped(uint8_t *data, uint32_t length, int64_t *kernel_rx_ns) {
+    iovec iov{data, length};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(scm_timestamping))];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    const ssize_t n = ::recvmsg(m_channel.fd(), &msg, MSG_DONTWAIT);
+    if (n <= 0) {
+        return n;
+    }
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            scm_timestamping stamps{};
+            std::memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            // ts[0] : horodatage logiciel
+            *kernel_rx_ns = (int64_t) stamps.ts[0].tv_sec * 1'000'000'000 + stamps.ts[0].tv_nsec;
+        }
+    }
+    return n;
+}
+
+void TcpConnection::trace_enqueue() {
+    m_latency->enqueue_ns = latency_clock_ns();
+}
+
+void TcpConnection::trace_drained() {
+    const int64_t now = latency_clock_ns();
+    if (m_latency->enqueue_ns != 0) {
+        m_latency->stats->queue.record(now - m_latency->enqueue_ns);
+        m_latency->enqueue_ns = 0;
+    }
+    if (m_latency->recv_ns != 0) {
+        m_latency->stats->total.record(now - m_latency->recv_ns);
+        m_latency->recv_ns = 0;
     }
 }
 
 void TcpConnection::set_timeout(time_t timeout) {
-    m_timeout = timeout;
-    m_last_event_time = TimeUtils::current_time_in_millis();
+    if (timeout < 0 || timeout > UINT16_MAX)
+    {
+        throw std::system_error(EINVAL, std::generic_category(), "connection timeout " + std::to_string(timeout));
+    }
+    m_timeout = (uint16_t) timeout;
+    m_last_event_time = m_loop->now_ms();
 }
 
 bool TcpConnection::is_connected() const {
@@ -242,11 +1210,11 @@ void TcpConnection::check_timeout(const uint64_t now) {
     if (m_shutdown_started) {
         if (now - m_shutdown_time > 5'000)
         {
-            DEBUG_E("HAMMER for %d [%s] state is %s", m_channel->fd(), ip_addr().c_str(), state_str().c_str());
+            DEBUG_E("HAMMER for %d [%ld] state is %s", m_channel.fd(), m_conn_id, state_str().c_str());
             handle_close(-1);
         }
     } else {
-        if (now - m_last_event_time > m_timeout * 1000L)
+        if (m_timeout != kNoTimeout && now - m_last_event_time > m_timeout * 1000L)
             graceful_shutdown();
     }
 }
@@ -8,8 +8,26 @@
 #include "EventLoop.hpp"
 #include "EventLoopThreadPool.hpp"
 #include "Acceptor.hpp"
+#include "Channel.hpp"
+#include "Connector.hpp"
+#include "TcpConnection.hpp"
+#include "LoopWatchdog.hpp"
+#include "Timer.h"
 #include <cassert>
 #include <utility>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <cstring>
+#include <algorithm>
+#include <system_error>
+
+#define HANDOFF_MAX_FDS 64
+#define HANDOFF_TIMEOUT_SEC 10
+// écart d'occupation minimal entre la boucle la plus chargée et la plus libre pour déplacer des connexions
+#define BALANCER_MIN_GAP 0.2
+// connexions examinées par migration autorisée, les plus gros lecteurs d'abord
+#define BALANCER_CANDIDATES 8
 #include "buffer/ProtoBuffer.h"
 
 TcpServer::TcpServer(EventLoop *loop, const uint16_t listen_port, std::string name, int server_id, int32_t snd_buff, int32_t rcv_buff, uint32_t num_threads)
@@ -20,11 +38,23 @@ TcpServer::TcpServer(EventLoop *loop, const uint16_t listen_port, std::string na
     m_thread_pool->set_pool_size(num_threads);
 }
 
+TcpServer::TcpServer(EventLoop *loop, std::string unix_path, std::string name, int server_id, uint32_t num_threads)
+        : m_loop(loop), m_listen_port(0), m_started(false),
+            m_thread_pool(std::make_unique<EventLoopThreadPool>(loop)), m_name(std::move(name)),
+            m_server_id(server_id), m_snd_buff(0), m_rcv_buff(0), m_unix_path(std::move(unix_path)) {
+
+    m_thread_pool->set_pool_size(num_threads);
+}
+
 int TcpServer::listen_port() const
 {
     return m_listen_port;
 }
 
+const std::vector<EventLoop *> &TcpServer::loops() const {
+    return m_thread_pool->loops();
+}
+
 uint32_t TcpServer::pool_size() const {
     return m_thread_pool->pool_size();
 }
@@ -37,24 +67,458 @@ void TcpServer::start() {
 
     assert(pool_size() > 0);
 
-    for (int i = 0; i < m_thread_pool->pool_size(); ++i)
+    if (m_idle_trim_sec >= 0) {
+        for (EventLoop *event_loop: m_thread_pool->loops()) {
+            event_loop->set_idle_trim((uint32_t) m_idle_trim_sec);
+        }
+    }
+
+    // réglages lus sans synchronisation par les boucles : appliqués dans leur thread, avant les listen() postés
+    // plus bas et donc avant la première connexion
+    if (m_sticky_write_interest) {
+        for (EventLoop *event_loop: m_thread_pool->loops()) {
+            event_loop->run([event_loop] { event_loop->set_sticky_write_interest(true); });
+        }
+    }
+
+    if (m_read_budget_set) {
+        for (EventLoop *event_loop: m_thread_pool->loops()) {
+            event_loop->run([event_loop, bytes = m_read_budget_bytes, calls = m_read_budget_calls] {
+                event_loop->set_read_budget(bytes, calls);
+            });
+        }
+    }
+
+    if (m_watchdog_budget_ms > 0 && m_watchdog == nullptr) {
+        m_watchdog = std::make_unique<LoopWatchdog>(m_watchdog_budget_ms);
+        m_watchdog->watch(m_loop);
+        for (EventLoop *event_loop: m_thread_pool->loops()) {
+            m_watchdog->watch(event_loop);
+        }
+        m_watchdog->start();
+    }
+
+    if (m_balance_period_ms > 0 && m_balance_timer == nullptr && m_thread_pool->loops().size() > 1) {
+        for (EventLoop *event_loop: m_thread_pool->loops()) {
+            event_loop->run([event_loop] { event_loop->set_traffic_sampling(true); });
+            m_balance_busy_ns.push_back(event_loop->busy_ns());
+        }
+        m_balance_time_ns = m_loop->now();
+        m_balance_timer = std::make_unique<Timer>([this] { balance(); }, m_loop);
+        m_balance_timer->set_timeout(m_balance_period_ms, true);
+        m_balance_timer->start();
+    }
+
+    if (m_admission == nullptr) {
+        m_admission = std::make_unique<AdmissionControl>(m_max_connections);
+    }
+
+    // les sockets adoptés d'un processus précédent passent avant ceux qu'on crée
+    const size_t adopted = m_adopted_fds.size();
+    const size_t count = std::max<size_t>(m_thread_pool->pool_size(), adopted);
+
+    // SO_REUSEPORT n'existe pas pour AF_UNIX : un seul socket, dupliqué pour l'Acceptor de chaque boucle
+    int unix_fd = -1;
+    if (!m_unix_path.empty()) {
+        unix_fd = adopted > 0 ? m_adopted_fds[0] : Acceptor::create_unix_socket(m_unix_path);
+    }
+
+    for (size_t i = 0; i < count; ++i)
     {
         EventLoop *event_loop = m_thread_pool->get_next_loop();
-        auto acceptor = std::make_unique<Acceptor>(event_loop, m_listen_port, m_snd_buff, m_rcv_buff);
+        std::unique_ptr<Acceptor> acceptor;
+        if (i < adopted) {
+            acceptor = std::make_unique<Acceptor>(event_loop, m_adopted_fds[i]);
+        } else if (unix_fd >= 0) {
+            const int fd = i == 0 ? unix_fd : ::fcntl(unix_fd, F_DUPFD_CLOEXEC, 0);
+            if (fd < 0) {
+                throw std::system_error(errno, std::generic_category(), "unix listener fcntl(F_DUPFD_CLOEXEC)");
+            }
+            acceptor = std::make_unique<Acceptor>(event_loop, fd);
+        } else {
+            acceptor = std::make_unique<Acceptor>(event_loop, m_listen_port, m_snd_buff, m_rcv_buff);
+        }
         acceptor->set_on_connection_state_change(m_connection_state_change_cb);
         acceptor->set_on_data_received(m_data_received_cb);
         acceptor->set_on_write_complete(m_write_complete_cb);
+        acceptor->set_accept_budget(m_accept_budget);
+        acceptor->set_max_connections(m_max_connections_per_loop);
+        acceptor->set_admission_control(m_admission.get());
+        acceptor->set_profile(m_profile);
+        acceptor->set_tls(m_tls);
+        if (!m_unix_path.empty()) {
+            // un seul socket dans l'epoll de chaque boucle : sans EPOLLEXCLUSIVE, chaque connexion les réveillerait toutes
+            acceptor->set_exclusive_wakeup();
+        }
 
         auto * a = acceptor.get();
         m_acceptors.push_back(std::move(acceptor));
-        event_loop->run([a]{a->listen();});
-        DEBUG_I("Server %s with id %d listening on port %d", m_name.c_str(), m_server_id, m_listen_port);
+        if (m_handoff_peer_fd < 0) {
+            event_loop->run([a]{a->listen();});
+        }
+        if (m_unix_path.empty()) {
+            DEBUG_I("Server %s with id %d listening on port %d%s", m_name.c_str(), m_server_id, m_listen_port, i < adopted ? " (adopted)" : "");
+        } else {
+            DEBUG_I("Server %s with id %d listening on unix socket %s%s", m_name.c_str(), m_server_id, m_unix_path.c_str(), i < adopted ? " (adopted)" : "");
+        }
+    }
+    m_adopted_fds.clear();
+    // coût fixe d'une connexion inactive, hors buffers alloués à la demande
+    DEBUG_I("Server %s: %zu bytes per idle connection object", m_name.c_str(), sizeof(TcpConnection));
+
+    if (m_handoff_peer_fd >= 0) {
+        // le processus précédent peut arrêter d'accepter : nos Acceptors tiennent les mêmes sockets, ils écouteront
+        // quand il l'aura fait
+        const char ack = 1;
+        if (::send(m_handoff_peer_fd, &ack, 1, MSG_NOSIGNAL | MSG_DONTWAIT) != 1) {
+            DEBUG_E("Server %s: handoff ack failed: %s", m_name.c_str(), strerror(errno));
+            close_handoff_peer();
+            listen_all();
+            return;
+        }
+        watch_handoff_peer([this] { handle_handoff_release(); }, [this] {
+            DEBUG_W("Server %s: previous process did not release the listeners, listening anyway", m_name.c_str());
+            close_handoff_peer();
+            listen_all();
+        });
     }
 }
 
+void TcpServer::listen_all() {
+    for (auto const &acceptor: m_acceptors) {
+        Acceptor *a = acceptor.get();
+        a->owner_loop()->run([a] { a->listen(); });
+    }
+}
+
+size_t TcpServer::adopt_listeners(const std::string &handoff_path) {
+    assert(!m_started);
+
+    sockaddr_storage addr{};
+    const socklen_t addr_len = Connector::make_unix_address(handoff_path, &addr);
+    if (addr_len == 0) {
+        throw std::system_error(ENAMETOOLONG, std::generic_category(), "handoff path");
+    }
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "socket()");
+    }
+
+    if (::connect(fd, (sockaddr *) &addr, addr_len) != 0) {
+        const int local_errno = errno;
+        ::close(fd);
+        if (local_errno == ECONNREFUSED || local_errno == ENOENT) {
+            DEBUG_I("Server %s: no process to take over on %s", m_name.c_str(), handoff_path.c_str());
+            return 0;
+        }
+        throw std::system_error(local_errno, std::generic_category(), "handoff connect()");
+    }
+
+    timeval timeout{HANDOFF_TIMEOUT_SEC, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    uint32_t count = 0;
+    iovec iov{&count, sizeof(count)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    const ssize_t n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    const int local_errno = errno;
+    std::vector<int> fds;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            const size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const auto *data = (const int *) CMSG_DATA(cmsg);
+            fds.insert(fds.end(), data, data + received);
+        }
+    }
+
+    if (n != sizeof(count) || fds.size() != count || (msg.msg_flags & MSG_CTRUNC) != 0) {
+        for (const int received_fd: fds) {
+            ::close(received_fd);
+        }
+        ::close(fd);
+        throw std::system_error(n < 0 ? local_errno : EPROTO, std::generic_category(), "handoff recvmsg()");
+    }
+
+    m_adopted_fds = std::move(fds);
+    m_handoff_peer_fd = fd;
+    DEBUG_I("Server %s adopted %u listening sockets from %s", m_name.c_str(), count, handoff_path.c_str());
+    return count;
+}
+
+void TcpServer::serve_handoff(const std::string &handoff_path, std::function<void()> const &cb) {
+    m_loop->assertInLoopThread();
+    assert(m_handoff_channel == nullptr);
+
+    m_handoff_cb = cb;
+    m_handoff_path = handoff_path;
+    m_handoff_listen_fd = Acceptor::create_unix_socket(handoff_path);
+    if (::listen(m_handoff_listen_fd, 4) != 0) {
+        const int local_errno = errno;
+        ::close(m_handoff_listen_fd);
+        m_handoff_listen_fd = -1;
+        throw std::system_error(local_errno, std::generic_category(), "handoff listen()");
+    }
+
+    m_handoff_channel = std::make_unique<Channel>(m_loop, m_handoff_listen_fd);
+    m_handoff_channel->set_read_cb([this](int64_t) { handle_handoff(); });
+    m_handoff_channel->enable_reading();
+}
+
+void TcpServer::handle_handoff() {
+    while (!m_handed_off) {
+        const int peer = ::accept4(m_handoff_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (peer < 0) {
+            return;
+        }
+        if (m_handoff_peer_fd >= 0) {
+            // un seul successeur à la fois
+            DEBUG_W("Server %s: handoff already in progress, refusing another successor", m_name.c_str());
+            ::close(peer);
+            continue;
+        }
+
+        std::vector<int> fds;
+        for (auto const &acceptor: m_acceptors) {
+            if (const int fd = acceptor->listen_fd(); fd >= 0 && fds.size() < HANDOFF_MAX_FDS) {
+                fds.push_back(fd);
+            }
+        }
+
+        auto count = (uint32_t) fds.size();
+        iovec iov{&count, sizeof(count)};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)]{};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+        // socket neuf, message de quelques octets : il tient dans le buffer, EAGAIN serait une erreur
+        if (::sendmsg(peer, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) != sizeof(count)) {
+            DEBUG_E("Server %s: handoff to successor failed: %s, still serving", m_name.c_str(), strerror(errno));
+            ::close(peer);
+            continue;
+        }
+
+        // on continue d'accepter jusqu'à la confirmation
+        m_handoff_peer_fd = peer;
+        watch_handoff_peer([this] { handle_handoff_ack(); }, [this] {
+            DEBUG_E("Server %s: successor did not confirm the handoff, still serving", m_name.c_str());
+            close_handoff_peer();
+        });
+    }
+}
+
+void TcpServer::watch_handoff_peer(std::function<void()> const &on_readable, std::function<void()> const &on_timeout) {
+    m_handoff_peer_channel = std::make_unique<Channel>(m_loop, m_handoff_peer_fd);
+    m_handoff_peer_channel->set_read_cb([on_readable](int64_t) { on_readable(); });
+    m_handoff_peer_channel->enable_reading();
+    m_handoff_timer = std::make_unique<Timer>(on_timeout, m_loop);
+    m_handoff_timer->set_timeout(HANDOFF_TIMEOUT_SEC * 1000, false);
+    m_handoff_timer->start();
+}
+
+void TcpServer::close_handoff_peer() {
+    if (m_handoff_peer_channel != nullptr) {
+        m_handoff_peer_channel->disable_all();
+        m_loop->remove_channel(m_handoff_peer_channel.get());
+        // appelé depuis le callback du channel ou du timer : ils sont détruits plus tard, dans la file de la boucle
+        std::shared_ptr<Channel> channel(m_handoff_peer_channel.release());
+        std::shared_ptr<Timer> timer(m_handoff_timer.release());
+        if (timer != nullptr) {
+            timer->stop();
+        }
+        m_loop->queue([channel, timer] {});
+    }
+    if (m_handoff_peer_fd >= 0) {
+        ::close(m_handoff_peer_fd);
+        m_handoff_peer_fd = -1;
+    }
+}
+
+void TcpServer::handle_handoff_ack() {
+    char ack = 0;
+    const ssize_t n = ::recv(m_handoff_peer_fd, &ack, 1, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (n != 1 || ack != 1) {
+        DEBUG_E("Server %s: successor gave up the handoff, still serving", m_name.c_str());
+        close_handoff_peer();
+        return;
+    }
+    m_handoff_timer->stop();
+
+    DEBUG_I("Server %s: successor adopted the listening sockets, draining", m_name.c_str());
+    m_handed_off = true;
+    close_handoff_listener();
+    m_handoff_stopping = m_acceptors.size();
+    if (m_handoff_stopping == 0) {
+        handoff_released();
+        return;
+    }
+    for (auto const &acceptor: m_acceptors) {
+        Acceptor *a = acceptor.get();
+        a->owner_loop()->run([this, a] {
+            a->stop_listening();
+            // derrière les connection_established déjà en file : une connexion acceptée juste avant l'arrêt est
+            // établie, et annoncée, avant d'être fermée
+            a->owner_loop()->queue([this, a] {
+                a->drain();
+                m_loop->run([this] {
+                    if (--m_handoff_stopping == 0) {
+                        handoff_released();
+                    }
+                });
+            });
+        });
+    }
+}
+
+void TcpServer::handoff_released() {
+    // plus aucun de nos Acceptors n'accepte : le successeur peut commencer
+    const char released = 1;
+    if (::send(m_handoff_peer_fd, &released, 1, MSG_NOSIGNAL | MSG_DONTWAIT) != 1) {
+        DEBUG_W("Server %s: handoff release not sent: %s", m_name.c_str(), strerror(errno));
+    }
+    close_handoff_peer();
+    if (m_handoff_cb) {
+        m_handoff_cb();
+    }
+}
+
+void TcpServer::handle_handoff_release() {
+    char released = 0;
+    const ssize_t n = ::recv(m_handoff_peer_fd, &released, 1, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (n != 1 || released != 1) {
+        // fermeture sans réponse : le processus précédent est parti, les sockets sont à nous
+        DEBUG_W("Server %s: previous process closed the handoff without releasing, listening", m_name.c_str());
+    }
+    close_handoff_peer();
+    listen_all();
+}
+
+void TcpServer::close_handoff_listener() {
+    m_handoff_channel->disable_all();
+    m_loop->remove_channel(m_handoff_channel.get());
+    // appelé depuis le callback du channel : il est détruit plus tard, dans la file de la boucle
+    std::shared_ptr<Channel> channel(m_handoff_channel.release());
+    m_loop->queue([channel] {});
+    ::close(m_handoff_listen_fd);
+    m_handoff_listen_fd = -1;
+    if (m_handoff_path[0] != '@') {
+        ::unlink(m_handoff_path.c_str());
+    }
+}
+
+// Occupation de chaque boucle depuis le tick précédent. La plus chargée, si elle dépasse le seuil, déplace ses plus gros
+// lecteurs vers la plus libre, sans y transférer plus de la moitié de l'écart ; les autres boucles remettent seulement
+// leur fenêtre d'échantillonnage à zéro. La part d'une connexion est estimée par sa part des octets lus.
+void TcpServer::balance() {
+    const std::vector<EventLoop *> &loops = m_thread_pool->loops();
+    const int64_t now = m_loop->now();
+    const auto elapsed = (double) (now - m_balance_time_ns);
+    m_balance_time_ns = now;
+    if (elapsed <= 0) {
+        return;
+    }
+
+    std::vector<double> busy(loops.size());
+    size_t hot = 0;
+    size_t cool = 0;
+    for (size_t i = 0; i < loops.size(); ++i) {
+        const uint64_t busy_ns = loops[i]->busy_ns();
+        busy[i] = (double) (busy_ns - m_balance_busy_ns[i]) / elapsed;
+        m_balance_busy_ns[i] = busy_ns;
+        if (busy[i] > busy[hot]) hot = i;
+        if (busy[i] < busy[cool]) cool = i;
+    }
+    const bool rebalance = busy[hot] > m_balance_high_ratio && busy[hot] - busy[cool] >= BALANCER_MIN_GAP;
+    if (rebalance) {
+        DEBUG_I("Server %s: loop %zu busy %.0f%%, loop %zu %.0f%%, moving connections", m_name.c_str(), hot,
+                busy[hot] * 100, cool, busy[cool] * 100);
+    }
+
+    for (size_t i = 0; i < loops.size(); ++i) {
+        EventLoop *event_loop = loops[i];
+        if (!rebalance || i != hot) {
+            event_loop->run([event_loop] { event_loop->take_traffic(0); });
+            continue;
+        }
+        EventLoop *target = loops[cool];
+        const double load = busy[hot];
+        const double budget = (busy[hot] - busy[cool]) / 2;
+        const uint32_t max_moves = m_balance_max_moves;
+        std::atomic<uint64_t> *migrations = &m_migrations;
+        event_loop->run([event_loop, target, load, budget, max_moves, migrations] {
+            const TrafficWindow window = event_loop->take_traffic((size_t) max_moves * BALANCER_CANDIDATES);
+            if (window.total_bytes == 0) {
+                return;
+            }
+            double remaining = budget;
+            uint32_t moves = 0;
+            for (auto const &sample: window.top) {
+                if (moves == max_moves) {
+                    break;
+                }
+                const double share = load * (double) sample.bytes / (double) window.total_bytes;
+                auto conn = sample.conn.lock();
+                if (share > remaining || conn == nullptr || !conn->migrate_to(target)) {
+                    continue;
+                }
+                remaining -= share;
+                ++moves;
+                migrations->fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+}
+
+size_t TcpServer::connection_count() const {
+    size_t total = 0;
+    for (auto const &acceptor: m_acceptors) {
+        total += acceptor->connection_count();
+    }
+    return total;
+}
+
+AdmissionStats TcpServer::admission_stats() const {
+    if (m_admission == nullptr) {
+        return AdmissionStats{};
+    }
+    return m_admission->stats();
+}
+
 int32_t TcpServer::server_id() const {
     return m_server_id;
 }
 
 
-TcpServer::~TcpServer() = default;
\ No newline at end of file
+TcpServer::~TcpServer()
+{
+    if (m_handoff_peer_fd >= 0) {
+        ::close(m_handoff_peer_fd);
+    }
+    for (const int fd: m_adopted_fds) {
+        ::close(fd);
+    }
+    // après un handoff, le fichier socket appartient au nouveau processus
+    if (m_started && !m_handed_off && !m_unix_path.empty() && m_unix_path[0] != '@') {
+        ::unlink(m_unix_path.c_str());
+    }
+}
\ No newline at end of file
@@ -61,10 +61,18 @@ void Timer::set_timeout(uint32_t ms, bool repeat)
 
 void Timer::on_event()
 {
-    m_callback();
     DEBUG_D("m_timer(%p) call", this);
-    if (m_started && m_repeatable && m_timeout != 0)
+    if (!m_repeatable)
+    {
+        // le timer a expiré : il doit pouvoir être relancé par start(), y compris depuis son callback.
+        // Plus aucun accès à this après le callback, qui peut détruire le timer
+        m_started = false;
+        m_callback();
+        return;
+    }
+    m_callback();
+    if (m_started && m_timeout != 0)
     {
         m_event_loop->schedule_event(m_event_object, m_timeout);
     }
-}
+}
\ No newline at end of file
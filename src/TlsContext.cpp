@@ -0,0 +1,293 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "TlsContext.hpp"
+#include "TcpConnection.hpp"
+#include "TlsState.h"
+#include "fastlog/FastLog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <system_error>
+
+#if defined(TKS_WITH_TLS)
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+// première erreur de la file OpenSSL du thread, la file est vidée
+static std::string ssl_error_text()
+{
+    char text[256];
+    ERR_error_string_n(ERR_get_error(), text, sizeof(text));
+    ERR_clear_error();
+    return text;
+}
+
+TlsContext::TlsContext(std::string const &cert_chain_file, std::string const &key_file, bool kernel_offload) :
+    m_ktls(kernel_offload)
+{
+    m_ctx = SSL_CTX_new(TLS_server_method());
+    if (m_ctx == nullptr)
+    {
+        throw std::system_error(ENOMEM, std::generic_category(), "SSL_CTX_new: " + ssl_error_text());
+    }
+    SSL_CTX_set_min_proto_version(m_ctx, TLS1_2_VERSION);
+
+    // une fin de flux sans close_notify est traitée comme la fermeture d'un socket en clair : le protocole
+    // applicatif délimite déjà ses messages
+    uint64_t options = SSL_OP_NO_COMPRESSION | SSL_OP_NO_RENEGOTIATION | SSL_OP_IGNORE_UNEXPECTED_EOF;
+    if (kernel_offload)
+    {
+        options |= SSL_OP_ENABLE_KTLS;
+    }
+    SSL_CTX_set_options(m_ctx, options);
+    // écritures partielles comme send(), reprises depuis un autre buffer (send_buffer de la boucle) ;
+    // une connexion inactive rend ses buffers d'enregistrement
+    SSL_CTX_set_mode(m_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+    if (SSL_CTX_use_certificate_chain_file(m_ctx, cert_chain_file.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(m_ctx, key_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(m_ctx) != 1)
+    {
+        const std::string error = ssl_error_text();
+        SSL_CTX_free(m_ctx);
+        throw std::system_error(EINVAL, std::generic_category(), "TLS certificate " + cert_chain_file + ": " + error);
+    }
+
+    // OpenSSL écrit avec write()/sendmsg() sans MSG_NOSIGNAL : un pair parti ne doit pas tuer le processus
+    struct sigaction current{};
+    if (::sigaction(SIGPIPE, nullptr, &current) == 0 && current.sa_handler == SIG_DFL)
+    {
+        ::signal(SIGPIPE, SIG_IGN);
+    }
+    DEBUG_I("TLS context ready (%s), kernel offload %s", OpenSSL_version(OPENSSL_VERSION), kernel_offload ? "requested" : "off");
+}
+
+TlsContext::~TlsContext()
+{
+    SSL_CTX_free(m_ctx);
+}
+
+void TcpConnection::tls_begin()
+{
+    ssl_st *ssl = SSL_new(m_tls->context->native());
+    if (ssl == nullptr || SSL_set_fd(ssl, m_channel.fd()) != 1)
+    {
+        DEBUG_E("TLS session for %ld failed: %s", m_conn_id, ssl_error_text().c_str());
+        SSL_free(ssl);
+        m_tls->context->count_handshake(false);
+        handle_error(ENOMEM);
+        return;
+    }
+    SSL_set_accept_state(ssl);
+    m_tls->ssl = ssl;
+    // le ClientHello est souvent déjà là (TCP_DEFER_ACCEPT)
+    tls_handshake();
+}
+
+// Appelé à chaque front tant que le handshake n'est pas terminé : OpenSSL lit et écrit sur le socket non bloquant
+// et dit ce qu'il attend. En edge-triggered, WANT_READ attend le prochain EPOLLIN, WANT_WRITE active EPOLLOUT.
+void TcpConnection::tls_handshake()
+{
+    ERR_clear_error();
+    const int rc = SSL_do_handshake(m_tls->ssl);
+    if (rc != 1)
+    {
+        const int error = SSL_get_error(m_tls->ssl, rc);
+        const int local_errno = errno;
+        if (error == SSL_ERROR_WANT_READ)
+        {
+            if (!m_sticky_out && m_channel.has_write_op() && !has_pending_output())
+            {
+                m_channel.disable_write();
+            }
+            return;
+        }
+        if (error == SSL_ERROR_WANT_WRITE)
+        {
+            m_write_blocked = true;
+            if (!m_channel.has_write_op())
+            {
+                m_channel.enable_writing();
+            }
+            return;
+        }
+
+        m_tls->context->count_handshake(false);
+        char peer[PeerAddress::kMaxFormatted];
+        m_peer.format(peer, sizeof(peer));
+        if (error == SSL_ERROR_SYSCALL)
+        {
+            DEBUG_W("TLS handshake failed for %ld [%s]: %s", m_conn_id, peer, local_errno != 0 ? strerror(local_errno) : "eof");
+        }
+        else
+        {
+            DEBUG_W("TLS handshake failed for %ld [%s]: %s", m_conn_id, peer, ssl_error_text().c_str());
+        }
+        handle_error(error == SSL_ERROR_SYSCALL && local_errno != 0 ? local_errno : EPROTO);
+        return;
+    }
+
+    TlsState &tls = *m_tls;
+    tls.established = true;
+    // OpenSSL a déjà passé les clés au noyau si SSL_OP_ENABLE_KTLS, la suite et le noyau le permettent
+    tls.ktls_tx = BIO_get_ktls_send(SSL_get_wbio(tls.ssl)) == 1;
+    tls.ktls_rx = BIO_get_ktls_recv(SSL_get_rbio(tls.ssl)) == 1;
+    tls.context->count_handshake(true);
+    tls.context->count_ktls(tls.ktls_tx, tls.ktls_rx);
+    DEBUG_D("TLS established for %ld: %s %s, kTLS tx %d rx %d", m_conn_id, SSL_get_version(tls.ssl),
+            SSL_get_cipher_name(tls.ssl), tls.ktls_tx, tls.ktls_rx);
+    if (!m_sticky_out && m_channel.has_write_op() && !has_pending_output())
+    {
+        m_channel.disable_write();
+    }
+
+    m_callbacks->state_change(shared_from_this());
+    if (m_state != kConnected)
+    {
+        return;
+    }
+    if (has_pending_output())
+    {
+        // écrit avant la fin du handshake, ou par le callback : l'EPOLLOUT éventuel a servi au handshake
+        m_write_blocked = false;
+        if (!m_channel.has_write_op())
+        {
+            m_channel.enable_writing();
+        }
+        handle_write();
+        if (m_state != kConnected)
+        {
+            return;
+        }
+    }
+    // données envoyées par le client avec son Finished : déjà déchiffrées par OpenSSL ou encore dans le socket,
+    // aucun nouveau front ne les signalera
+    handle_read(m_loop->now_ms());
+}
+
+ssize_t TcpConnection::tls_recv(uint8_t *data, uint32_t length)
+{
+    ERR_clear_error();
+    const int n = SSL_read(m_tls->ssl, data, (int) std::min<uint32_t>(length, INT_MAX));
+    if (n > 0)
+    {
+        return n;
+    }
+    const int local_errno = errno;
+    switch (SSL_get_error(m_tls->ssl, n))
+    {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        case SSL_ERROR_SYSCALL:
+            if (local_errno == 0)
+            {
+                return 0;
+            }
+            errno = local_errno;
+            return -1;
+        default:
+            DEBUG_W("TLS read failed for %ld: %s", m_conn_id, ssl_error_text().c_str());
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+ssize_t TcpConnection::tls_send(const uint8_t *data, uint32_t length)
+{
+    ERR_clear_error();
+    const int n = SSL_write(m_tls->ssl, data, (int) std::min<uint32_t>(length, INT_MAX));
+    if (n > 0)
+    {
+        return n;
+    }
+    const int local_errno = errno;
+    switch (SSL_get_error(m_tls->ssl, n))
+    {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_SYSCALL:
+            errno = local_errno != 0 ? local_errno : EPIPE;
+            return -1;
+        default:
+            DEBUG_W("TLS write failed for %ld: %s", m_conn_id, ssl_error_text().c_str());
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+// close_notify avant shutdown(SHUT_WR), au mieux : un socket plein ne retarde pas la fermeture
+void TcpConnection::tls_close_notify() const
+{
+    if (!m_tls->established || m_tls->close_notify_sent)
+    {
+        return;
+    }
+    m_tls->close_notify_sent = true;
+    ERR_clear_error();
+    SSL_shutdown(m_tls->ssl);
+    ERR_clear_error();
+}
+
+bool TcpConnection::tls_pending() const
+{
+    return m_tls->ssl != nullptr && SSL_pending(m_tls->ssl) > 0;
+}
+
+#else
+
+TlsContext::TlsContext(std::string const &, std::string const &, bool kernel_offload) :
+    m_ktls(kernel_offload)
+{
+    throw std::system_error(ENOTSUP, std::generic_category(), "tcpserver built without TLS (TCPSERVER_WITH_TLS)");
+}
+
+TlsContext::~TlsContext() = default;
+
+// sans TKS_WITH_TLS aucun TlsContext n'existe, donc aucune connexion TLS : ces chemins ne sont jamais pris
+
+void TcpConnection::tls_begin()
+{
+    handle_error(ENOTSUP);
+}
+
+void TcpConnection::tls_handshake()
+{
+    handle_error(ENOTSUP);
+}
+
+ssize_t TcpConnection::tls_recv(uint8_t *, uint32_t)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t TcpConnection::tls_send(const uint8_t *, uint32_t)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+void TcpConnection::tls_close_notify() const
+{
+}
+
+bool TcpConnection::tls_pending() const
+{
+    return false;
+}
+
+#endif
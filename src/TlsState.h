@@ -0,0 +1,37 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#ifndef TKS_TLS_STATE_H
+#define TKS_TLS_STATE_H
+
+#include <memory>
+
+#if defined(TKS_WITH_TLS)
+#include <openssl/ssl.h>
+#endif
+
+struct ssl_st;
+class TlsContext;
+
+// état TLS d'une TcpConnection acceptée par un serveur TLS, voir TlsContext
+struct TlsState
+{
+    std::shared_ptr<TlsContext> context;
+    ssl_st *ssl{nullptr};     // créé dans la boucle, à connection_established()
+    bool established{false};  // handshake terminé, le callback "connecté" a été appelé
+    bool ktls_tx{false};      // send()/splice() directs : le noyau chiffre
+    bool ktls_rx{false};
+    bool close_notify_sent{false};
+
+    ~TlsState()
+    {
+#if defined(TKS_WITH_TLS)
+        SSL_free(ssl);
+#endif
+    }
+};
+
+#endif //TKS_TLS_STATE_H
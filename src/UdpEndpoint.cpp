@@ -0,0 +1,380 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "UdpEndpoint.hpp"
+#include "Channel.hpp"
+#include "EventLoop.hpp"
+#include "fastlog/FastLog.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+
+// un entier UDP_GRO (taille des segments) par message reçu
+static constexpr size_t kRecvControlSize = CMSG_SPACE(sizeof(int));
+
+static socklen_t address_length(PeerAddress const &address)
+{
+    return address.family() == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+}
+
+static bool same_address(PeerAddress const &a, PeerAddress const &b)
+{
+    return a.family() == b.family() && std::memcmp(a.address(), b.address(), address_length(a)) == 0;
+}
+
+UdpEndpoint::UdpEndpoint(EventLoop *loop, uint16_t port, bool reuse_port, int32_t snd_buff, int32_t rcv_buff) :
+    m_loop(loop), m_port(port)
+{
+    const int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "udp socket()");
+    }
+
+    int on{1};
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+    {
+        const int local_errno = errno;
+        ::close(fd);
+        throw std::system_error(local_errno, std::generic_category(), "udp setsockopt SO_REUSEPORT");
+    }
+    if (snd_buff > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &snd_buff, sizeof(int)) != 0)
+    {
+        DEBUG_W("UDP port %d: SO_SNDBUF %d: %s", port, snd_buff, std::strerror(errno));
+    }
+    if (rcv_buff > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcv_buff, sizeof(int)) != 0)
+    {
+        DEBUG_W("UDP port %d: SO_RCVBUF %d: %s", port, rcv_buff, std::strerror(errno));
+    }
+
+    sockaddr_in addr{};
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        const int local_errno = errno;
+        ::close(fd);
+        throw std::system_error(local_errno, std::generic_category(), "udp bind()");
+    }
+    if (port == 0)
+    {
+        socklen_t addr_len = sizeof(addr);
+        if (getsockname(fd, (sockaddr *) &addr, &addr_len) == 0)
+        {
+            m_port = ntohs(addr.sin_port);
+        }
+    }
+
+    m_channel = std::make_unique<Channel>(loop, fd);
+    m_channel->set_read_cb([this](int64_t time) { handle_read(time); });
+    m_channel->set_write_cb([this] { flush(); });
+    m_channel->set_error_cb([this] { handle_error(); });
+}
+
+UdpEndpoint::~UdpEndpoint()
+{
+    m_alive.reset();
+    const int fd = m_channel->fd();
+    if (m_started)
+    {
+        m_channel->disable_all();
+        m_loop->remove_channel(m_channel.get());
+    }
+    ::close(fd);
+}
+
+int UdpEndpoint::fd() const
+{
+    return m_channel->fd();
+}
+
+bool UdpEndpoint::enable_gro()
+{
+    assert(!m_started);
+    int on{1};
+    if (setsockopt(m_channel->fd(), IPPROTO_UDP, UDP_GRO, &on, sizeof(on)) != 0)
+    {
+        DEBUG_W("UDP port %d: UDP_GRO refused: %s", m_port, std::strerror(errno));
+        return false;
+    }
+    m_gro = true;
+    m_slot_size = UDP_GRO_SLOT_SIZE;
+    return true;
+}
+
+void UdpEndpoint::start()
+{
+    m_loop->assertInLoopThread();
+    assert(!m_started && m_on_datagram != nullptr);
+
+    // tout est préparé ici : recvmmsg ne fait ensuite que remettre les longueurs à jour
+    m_slots.resize((size_t) m_slot_size * UDP_RECV_BATCH);
+    m_recv_msgs.resize(UDP_RECV_BATCH);
+    m_recv_iovs.resize(UDP_RECV_BATCH);
+    m_recv_addrs.resize(UDP_RECV_BATCH);
+    if (m_gro)
+    {
+        m_recv_control.resize(kRecvControlSize * UDP_RECV_BATCH);
+    }
+    for (size_t i = 0; i < UDP_RECV_BATCH; ++i)
+    {
+        m_recv_iovs[i] = iovec{m_slots.data() + i * m_slot_size, m_slot_size};
+        msghdr &hdr = m_recv_msgs[i].msg_hdr;
+        hdr = msghdr{};
+        hdr.msg_iov = &m_recv_iovs[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_name = &m_recv_addrs[i];
+    }
+
+    m_started = true;
+    m_channel->enable_reading();
+    DEBUG_I("UDP endpoint listening on port %d (GRO %s, GSO %s)", m_port, m_gro ? "on" : "off", m_gso ? "on" : "off");
+}
+
+void UdpEndpoint::handle_read(const int64_t receive_time)
+{
+    m_loop->assertInLoopThread();
+    m_read_resume_queued = false;
+
+    const uint32_t budget_calls = m_loop->read_budget_calls();
+    uint32_t calls = 0;
+    while (true)
+    {
+        for (size_t i = 0; i < UDP_RECV_BATCH; ++i)
+        {
+            msghdr &hdr = m_recv_msgs[i].msg_hdr;
+            hdr.msg_namelen = sizeof(sockaddr_storage);
+            hdr.msg_flags = 0;
+            if (m_gro)
+            {
+                hdr.msg_control = m_recv_control.data() + i * kRecvControlSize;
+                hdr.msg_controllen = kRecvControlSize;
+            }
+        }
+
+        const int count = ::recvmmsg(m_channel->fd(), m_recv_msgs.data(), UDP_RECV_BATCH, MSG_DONTWAIT, nullptr);
+        if (count < 0)
+        {
+            const int local_errno = errno;
+            if (local_errno != EAGAIN && local_errno != EWOULDBLOCK && local_errno != EINTR)
+            {
+                DEBUG_E("UDP port %d: recvmmsg: %s", m_port, std::strerror(local_errno));
+            }
+            return;
+        }
+        ++m_recv_calls;
+
+        for (int i = 0; i < count; ++i)
+        {
+            msghdr &hdr = m_recv_msgs[i].msg_hdr;
+            if (hdr.msg_flags & MSG_TRUNC)
+            {
+                ++m_truncated;
+                continue;
+            }
+
+            uint32_t segment_size = 0;
+            if (m_gro)
+            {
+                for (cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+                {
+                    if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO)
+                    {
+                        int gso_size = 0;
+                        std::memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                        segment_size = (uint32_t) gso_size;
+                    }
+                }
+            }
+
+            const PeerAddress from((sockaddr *) hdr.msg_name, hdr.msg_namelen);
+            const uint8_t *data = static_cast<const uint8_t *>(hdr.msg_iov->iov_base);
+            const uint32_t length = m_recv_msgs[i].msg_len;
+            if (segment_size == 0 || segment_size >= length)
+            {
+                ++m_received;
+                m_on_datagram(from, data, length, receive_time);
+                continue;
+            }
+            // GRO : segments de segment_size octets, le dernier éventuellement plus court
+            for (uint32_t offset = 0; offset < length; offset += segment_size)
+            {
+                ++m_received;
+                m_on_datagram(from, data + offset, std::min(segment_size, length - offset), receive_time);
+            }
+        }
+
+        if (count < UDP_RECV_BATCH)
+        {
+            // lot incomplet : la file du socket est vide, inutile de payer un recvmmsg pour lire EAGAIN
+            return;
+        }
+        if (budget_calls != 0 && ++calls >= budget_calls)
+        {
+            // même budget que les connexions : le reste est lu à l'itération suivante
+            if (!m_read_resume_queued)
+            {
+                m_read_resume_queued = true;
+                m_loop->queue_next_iteration([this, alive = std::weak_ptr<bool>(m_alive)] {
+                    if (!alive.expired()) handle_read(m_loop->now_ms());
+                });
+            }
+            return;
+        }
+    }
+}
+
+void UdpEndpoint::handle_error()
+{
+    int opt_val = 0;
+    socklen_t opt_len = sizeof(opt_val);
+    ::getsockopt(m_channel->fd(), SOL_SOCKET, SO_ERROR, &opt_val, &opt_len);
+    DEBUG_W("UDP port %d: socket error %d: %s", m_port, opt_val, std::strerror(opt_val));
+}
+
+bool UdpEndpoint::send_to(PeerAddress const &to, const uint8_t *data, uint32_t length)
+{
+    m_loop->assertInLoopThread();
+    // socket AF_INET : une adresse IPv6 ferait échouer sendmmsg (EINVAL), pris pour un refus de GSO
+    if (length > UDP_MAX_PAYLOAD || m_out_bytes.size() + length > UDP_SEND_QUEUE_MAX || to.family() != AF_INET)
+    {
+        ++m_dropped;
+        return false;
+    }
+    const auto offset = (uint32_t) m_out_bytes.size();
+    m_out_bytes.insert(m_out_bytes.end(), data, data + length);
+    m_out.push_back(OutDatagram{to, offset, length});
+    schedule_flush();
+    return true;
+}
+
+void UdpEndpoint::schedule_flush()
+{
+    if (m_flush_queued || m_channel->has_write_op())
+    {
+        // déjà prévu, ou socket plein : EPOLLOUT relancera flush()
+        return;
+    }
+    m_flush_queued = true;
+    // après les autres événements de l'itération : un seul sendmmsg pour tout ce qu'ils ont envoyé
+    m_loop->queue([this, alive = std::weak_ptr<bool>(m_alive)]
+    {
+        if (alive.expired())
+        {
+            return;
+        }
+        m_flush_queued = false;
+        flush();
+    });
+}
+
+void UdpEndpoint::flush()
+{
+    m_loop->assertInLoopThread();
+
+    mmsghdr msgs[UDP_SEND_BATCH];
+    iovec iovs[UDP_SEND_BATCH];
+    size_t datagrams[UDP_SEND_BATCH]; // datagrammes portés par chaque message
+    alignas(cmsghdr) char control[UDP_SEND_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+
+    while (m_out_sent < m_out.size())
+    {
+        int count = 0;
+        size_t next = m_out_sent;
+        while (count < UDP_SEND_BATCH && next < m_out.size())
+        {
+            const OutDatagram &first = m_out[next];
+            size_t segments = 1;
+            uint32_t bytes = first.length;
+            if (m_gso && first.length <= UDP_GSO_MAX_SEGMENT_SIZE)
+            {
+                // segments contigus dans m_out_bytes : un seul iovec, tous de la taille du premier sauf le dernier
+                while (next + segments < m_out.size() && segments < UDP_GSO_MAX_SEGMENTS)
+                {
+                    const OutDatagram &candidate = m_out[next + segments];
+                    if (m_out[next + segments - 1].length != first.length || candidate.length > first.length ||
+                        bytes + candidate.length > UDP_MAX_PAYLOAD || !same_address(candidate.to, first.to))
+                    {
+                        break;
+                    }
+                    bytes += candidate.length;
+                    ++segments;
+                }
+            }
+
+            iovs[count] = iovec{m_out_bytes.data() + first.offset, bytes};
+            msghdr &hdr = msgs[count].msg_hdr;
+            hdr = msghdr{};
+            hdr.msg_name = const_cast<sockaddr *>(first.to.address());
+            hdr.msg_namelen = address_length(first.to);
+            hdr.msg_iov = &iovs[count];
+            hdr.msg_iovlen = 1;
+            if (segments > 1)
+            {
+                hdr.msg_control = control[count];
+                hdr.msg_controllen = sizeof(control[count]);
+                cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+                cmsg->cmsg_level = IPPROTO_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                const auto segment_size = (uint16_t) first.length;
+                std::memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+            }
+            datagrams[count] = segments;
+            next += segments;
+            ++count;
+        }
+
+        const int sent = ::sendmmsg(m_channel->fd(), msgs, (unsigned int) count, MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            const int local_errno = errno;
+            if (local_errno == EAGAIN || local_errno == EWOULDBLOCK || local_errno == ENOBUFS)
+            {
+                if (!m_channel->has_write_op())
+                {
+                    m_channel->enable_writing();
+                }
+                return;
+            }
+            if (datagrams[0] > 1 && (local_errno == EIO || local_errno == EINVAL))
+            {
+                // pas de GSO sur ce chemin (noyau, carte sans checksum offload) : on repasse en datagrammes simples
+                DEBUG_W("UDP port %d: UDP_SEGMENT refused (%s), GSO disabled", m_port, std::strerror(local_errno));
+                m_gso = false;
+                continue;
+            }
+            // erreur propre au premier message (destinataire injoignable...) : il est perdu, pas les suivants
+            DEBUG_W("UDP port %d: sendmmsg: %s", m_port, std::strerror(local_errno));
+            m_dropped += datagrams[0];
+            m_out_sent += datagrams[0];
+            continue;
+        }
+
+        ++m_send_calls;
+        for (int i = 0; i < sent; ++i)
+        {
+            m_out_sent += datagrams[i];
+            m_sent += datagrams[i];
+        }
+    }
+
+    // tout est parti : la file reprend au début, sa capacité est gardée pour la prochaine itération
+    m_out.clear();
+    m_out_bytes.clear();
+    m_out_sent = 0;
+    if (m_channel->has_write_op())
+    {
+        m_channel->disable_write();
+    }
+}
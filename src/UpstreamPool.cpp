@@ -0,0 +1,98 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+#include "UpstreamPool.hpp"
+#include "TcpClient.hpp"
+#include "TcpConnection.hpp"
+#include "EventLoop.hpp"
+
+#include <algorithm>
+#include <utility>
+
+UpstreamPool::UpstreamPool(EventLoop *loop, std::string ip, uint16_t port, uint32_t size)
+        : m_loop(loop), m_ip(std::move(ip)), m_port(port), m_size(size)
+{
+}
+
+UpstreamPool::~UpstreamPool()
+{
+    m_loop->assertInLoopThread();
+    m_idle.clear();
+    m_clients.clear();
+}
+
+void UpstreamPool::start()
+{
+    m_loop->run([this]
+    {
+        if (!m_clients.empty())
+        {
+            return;
+        }
+
+        for (uint32_t i = 0; i < m_size; ++i)
+        {
+            auto client = std::make_unique<TcpClient>(m_loop, m_ip, m_port, "upstream-" + m_ip);
+            client->enable_retry(true);
+            client->set_on_connection_state_change([this](auto const &conn) { on_connection_state_change(conn); });
+            client->set_on_data_received([this](auto const &conn, ProtoBuffer *buf, int64_t time)
+            {
+                if (m_data_received_cb) m_data_received_cb(conn, buf, time);
+            });
+            client->set_on_write_complete([](auto const &) {});
+            client->connect();
+            m_clients.push_back(std::move(client));
+        }
+    });
+}
+
+std::shared_ptr<TcpConnection> UpstreamPool::acquire()
+{
+    m_loop->assertInLoopThread();
+    while (!m_idle.empty())
+    {
+        auto conn = std::move(m_idle.back());
+        m_idle.pop_back();
+        if (conn->is_connected())
+        {
+            return conn;
+        }
+    }
+    return nullptr;
+}
+
+void UpstreamPool::release(std::shared_ptr<TcpConnection> const &conn)
+{
+    m_loop->assertInLoopThread();
+    if (conn->is_connected())
+    {
+        m_idle.push_back(conn);
+    }
+}
+
+void UpstreamPool::on_connection_state_change(std::shared_ptr<TcpConnection> const &conn)
+{
+    // une connexion amont ne doit pas être fermée pour inactivité
+    if (conn->is_connected())
+    {
+        conn->set_timeout(TcpConnection::kNoTimeout);
+        m_idle.push_back(conn);
+    }
+    else
+    {
+        remove_idle(conn);
+    }
+
+    if (m_connection_state_change_cb)
+    {
+        m_connection_state_change_cb(conn);
+    }
+}
+
+void UpstreamPool::remove_idle(std::shared_ptr<TcpConnection> const &conn)
+{
+    m_idle.erase(std::remove(m_idle.begin(), m_idle.end(), conn), m_idle.end());
+}
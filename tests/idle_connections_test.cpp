@@ -0,0 +1,181 @@
+/*
+ * Created by Steve Tchatchouang
+ *
+ * Copyright (c) 2022 All rights reserved
+ */
+
+// N connexions loopback inactives (100 000 par défaut) : la mémoire utilisateur consommée par connexion, mesurée par
+// mallinfo2, doit rester proche du chiffre annoncé au démarrage (sizeof(TcpConnection), voir TcpServer::start).
+//
+//   idle_connections_test [--connections=N] [--port=PORT]
+//
+// Il faut deux fd par connexion (les deux bouts sont dans ce processus) : sans RLIMIT_NOFILE suffisant, le test est
+// ignoré (code 77). Les adresses 127.0.0.1 à 127.0.0.4 sont utilisées pour ne pas épuiser les ports éphémères.
+
+#include "tcpserver/TcpServer.hpp"
+#include "tcpserver/TcpConnection.hpp"
+#include "tcpserver/EventLoop.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <malloc.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define TEST_SKIPPED 77
+// en plus de l'objet : bloc de contrôle de make_shared, nœud de la table des connexions de l'Acceptor, en-têtes malloc
+#define CONNECTION_BOOKKEEPING_BYTES 128
+#define CONNECT_DEADLINE_SEC 120
+
+static bool raise_fd_limit(size_t needed)
+{
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+    {
+        return false;
+    }
+    if (limit.rlim_cur >= needed)
+    {
+        return true;
+    }
+    if (limit.rlim_max < needed)
+    {
+        return false;
+    }
+    limit.rlim_cur = needed;
+    return setrlimit(RLIMIT_NOFILE, &limit) == 0;
+}
+
+struct IdleTestOptions
+{
+    size_t connections{100000};
+    uint16_t port{19310};
+};
+
+static bool parse_options(int argc, char **argv, IdleTestOptions &opts)
+{
+    static const option long_options[] = {
+            {"connections", required_argument, nullptr, 'n'},
+            {"port",        required_argument, nullptr, 'p'},
+            {nullptr, 0,                       nullptr, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                opts.connections = strtoul(optarg, nullptr, 10);
+                break;
+            case 'p':
+                opts.port = (uint16_t) strtoul(optarg, nullptr, 10);
+                break;
+            default:
+                return false;
+        }
+    }
+    return optind == argc && opts.connections > 0;
+}
+
+static size_t heap_in_use()
+{
+    return mallinfo2().uordblks;
+}
+
+int main(int argc, char **argv)
+{
+    IdleTestOptions opts;
+    if (!parse_options(argc, argv, opts))
+    {
+        fprintf(stderr, "usage: %s [--connections=N] [--port=PORT]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const size_t connections = opts.connections;
+    const uint16_t port = opts.port;
+
+    if (!raise_fd_limit(connections * 2 + 256))
+    {
+        printf("SKIP: RLIMIT_NOFILE too low for %zu connections\n", connections);
+        return TEST_SKIPPED;
+    }
+
+    EventLoop loop;
+    TcpServer server(&loop, port, "idle", 1, 0, 0, 1);
+    std::atomic<size_t> established{0};
+    server.set_on_connection_state_change([&](std::shared_ptr<TcpConnection> const &conn) {
+        if (conn->is_connected())
+        {
+            established.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    server.set_on_data_received([](std::shared_ptr<TcpConnection> const &, ProtoBuffer *, int64_t) {});
+    server.set_on_write_complete([](std::shared_ptr<TcpConnection> const &) {});
+    server.start();
+
+    int status = EXIT_FAILURE;
+    std::thread client([&] {
+        std::vector<int> fds;
+        fds.reserve(connections);
+        // vérifié dans le thread du client, avant toute connexion : ce qui suit n'alloue plus côté client
+        const size_t heap_before = heap_in_use();
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(CONNECT_DEADLINE_SEC);
+        for (size_t i = 0; i < connections; ++i)
+        {
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(0x7f000001 + (uint32_t) (i % 4));
+            const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0 || ::connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0)
+            {
+                printf("FAIL: connection %zu: %s\n", i, strerror(errno));
+                fflush(stdout);
+                _exit(EXIT_FAILURE);
+            }
+            fds.push_back(fd);
+            // le backlog du listener est limité : on laisse le serveur accepter
+            while (i + 1 - established.load(std::memory_order_relaxed) > 1024)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+        while (established.load(std::memory_order_relaxed) < connections)
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                printf("FAIL: %zu/%zu connections established\n", established.load(), connections);
+                fflush(stdout);
+                _exit(EXIT_FAILURE);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        const size_t heap_after = heap_in_use();
+        const double per_connection = (double) (heap_after - heap_before) / (double) connections;
+        const size_t limit = sizeof(TcpConnection) + CONNECTION_BOOKKEEPING_BYTES;
+        printf("%zu idle connections: %.1f heap bytes each, reported object %zu bytes, limit %zu\n",
+               connections, per_connection, sizeof(TcpConnection), limit);
+        status = per_connection <= (double) limit ? EXIT_SUCCESS : EXIT_FAILURE;
+        if (status != EXIT_SUCCESS)
+        {
+            printf("FAIL: per-connection memory above the reported figure\n");
+        }
+        fflush(stdout);
+        // les connexions restent ouvertes jusqu'à la sortie : la fermeture n'est pas ce qu'on mesure
+        _exit(status);
+    });
+    loop.loop();
+    client.join();
+    return status;
+}